@@ -0,0 +1,222 @@
+#include "asset-bundle.h"
+#include <texture.h>
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <random>
+
+const char *AssetBundle::defaultFile = "./resources/assets.bundle";
+
+const std::vector<std::string> AssetBundle::imageFiles = {
+	"./resources/pacman.png",
+	"./resources/ghost_mask.png",
+	"./resources/ghost_eyes.png",
+};
+const std::vector<std::string> AssetBundle::blobFiles = {
+	"./resources/ProggyClean.ttf",
+};
+
+// on disk: magic, version, entry count, then every entry as a header, its name and its data
+struct EntryHeader {
+	uint32_t type;
+	uint32_t nameSize;
+	uint32_t width, height;
+	uint64_t dataSize;
+};
+
+namespace {
+struct DecodedImage {
+	int					 width = 0, height = 0;
+	std::vector<uint8_t> texels;
+};
+
+DecodedImage decodeImage(const std::string &file) {
+	DecodedImage image;
+	int			 channels;
+	stbi_uc		*data = stbi_load(file.c_str(), &image.width, &image.height, &channels, 4);
+	if (data == nullptr) {
+		dbLog(ygl::LOG_ERROR, "Cannot load image: ", file, " : ", stbi_failure_reason());
+		THROW_RUNTIME_ERR("failed to decode an image for the asset bundle");
+	}
+	// GL puts the first row of a texture at the bottom (t = 0). ygl's Texture2d(file) flips images on load, and
+	// createMap() writes the rows of the map texture bottom first too, which is why both show upright on the same
+	// quad. The bundle stores the rows in that order, so createTexture() uploads what Texture2d(file) did.
+	// SoftwareRasterizer samples the unflipped image with 1 - v for the same reason
+	std::size_t rowSize = image.width * 4;
+	image.texels.resize(rowSize * image.height);
+	for (int y = 0; y < image.height; ++y) {
+		memcpy(&image.texels[y * rowSize], data + (image.height - y - 1) * rowSize, rowSize);
+	}
+	stbi_image_free(data);
+	return image;
+}
+
+std::vector<uint8_t> readFile(const std::string &file) {
+	std::ifstream in(file, std::ios::binary);
+	if (!in) {
+		dbLog(ygl::LOG_ERROR, "Cannot open file: ", file, " : ", std::strerror(errno));
+		THROW_RUNTIME_ERR("failed to read a file for the asset bundle");
+	}
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+template <class T>
+void append(std::vector<uint8_t> &out, const T *data, std::size_t count) {
+	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+	out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+}	  // namespace
+
+bool AssetBundle::load(const std::string &file) {
+	namespace fs = std::filesystem;
+	std::error_code error;
+
+	fs::file_time_type bundleTime = fs::last_write_time(file, error);
+	if (error) return false;
+	for (const std::vector<std::string> *sources : {&imageFiles, &blobFiles}) {
+		for (const std::string &source : *sources) {
+			fs::file_time_type sourceTime = fs::last_write_time(source, error);
+			if (!error && sourceTime > bundleTime) {
+				dbLog(ygl::LOG_INFO, "asset bundle is older than ", source);
+				return false;
+			}
+		}
+	}
+
+	std::ifstream in(file, std::ios::binary);
+	if (!in) return false;
+	std::size_t size = fs::file_size(file, error);
+	if (error) return false;
+	contents.resize(size);
+	if (!in.read(reinterpret_cast<char *>(contents.data()), size)) return false;
+
+	if (!parse()) {
+		dbLog(ygl::LOG_WARNING, "asset bundle ", file, " is damaged or from another version");
+		return false;
+	}
+	return true;
+}
+
+bool AssetBundle::parse() {
+	images.clear();
+	blobs.clear();
+
+	std::size_t offset = 0;
+	auto		read   = [&](void *out, std::size_t size) {
+		   if (offset + size > contents.size()) return false;
+		   memcpy(out, contents.data() + offset, size);
+		   offset += size;
+		   return true;
+	};
+
+	char	 fileMagic[4];
+	uint32_t fileVersion, count;
+	if (!read(fileMagic, sizeof(fileMagic)) || memcmp(fileMagic, magic, sizeof(magic)) != 0) return false;
+	if (!read(&fileVersion, sizeof(fileVersion)) || fileVersion != version) return false;
+	if (!read(&count, sizeof(count))) return false;
+
+	for (uint32_t i = 0; i < count; ++i) {
+		EntryHeader header;
+		if (!read(&header, sizeof(header))) return false;
+		// compared without sums, a damaged header must not overflow its way past the check
+		if (header.nameSize > contents.size() - offset) return false;
+		if (header.dataSize > contents.size() - offset - header.nameSize) return false;
+		std::string name(reinterpret_cast<const char *>(contents.data() + offset), header.nameSize);
+		offset += header.nameSize;
+		uint8_t *data = contents.data() + offset;
+		offset += header.dataSize;
+
+		if (header.type == IMAGE) {
+			// below INT_MAX, so that the size fits an Image and the product cannot wrap around
+			if (header.width > INT_MAX || header.height > INT_MAX) return false;
+			if (uint64_t(header.width) * header.height * 4 != header.dataSize) return false;
+			images[name] = Image{int(header.width), int(header.height), data};
+		} else blobs[name] = Blob{data, header.dataSize};
+	}
+	return true;
+}
+
+void AssetBundle::build() {
+	// PNG decoding is the slow part, every image gets its own thread
+	std::vector<std::future<DecodedImage>> decoding;
+	for (const std::string &file : imageFiles) {
+		decoding.push_back(std::async(std::launch::async, decodeImage, file));
+	}
+	std::vector<std::vector<uint8_t>> blobData;
+	for (const std::string &file : blobFiles) {
+		blobData.push_back(readFile(file));
+	}
+
+	contents.clear();
+	uint32_t count = imageFiles.size() + blobFiles.size();
+	append(contents, magic, sizeof(magic));
+	append(contents, &version, 1);
+	append(contents, &count, 1);
+
+	auto addEntry = [this](EntryType type, const std::string &name, int width, int height,
+						   const std::vector<uint8_t> &data) {
+		EntryHeader header{type, uint32_t(name.size()), uint32_t(width), uint32_t(height), data.size()};
+		append(contents, &header, 1);
+		append(contents, name.data(), name.size());
+		append(contents, data.data(), data.size());
+	};
+	for (std::size_t i = 0; i < imageFiles.size(); ++i) {
+		DecodedImage image = decoding[i].get();
+		addEntry(IMAGE, imageFiles[i], image.width, image.height, image.texels);
+	}
+	for (std::size_t i = 0; i < blobFiles.size(); ++i) {
+		addEntry(BLOB, blobFiles[i], 0, 0, blobData[i]);
+	}
+
+	if (!parse()) THROW_RUNTIME_ERR("failed to build the asset bundle");
+}
+
+void AssetBundle::save(const std::string &file) {
+	// every writer gets its own temporary file, so that two games packing at once do not mix their writes
+	std::string temporary = file + ".tmp" + std::to_string(std::random_device()());
+	{
+		std::ofstream out(temporary, std::ios::binary);
+		if (!out || !out.write(reinterpret_cast<const char *>(contents.data()), contents.size()) || !out.flush()) {
+			dbLog(ygl::LOG_WARNING, "Cannot write asset bundle: ", temporary, " : ", std::strerror(errno));
+			out.close();
+			std::remove(temporary.c_str());
+			return;
+		}
+	}
+	if (std::rename(temporary.c_str(), file.c_str()) != 0) {
+		dbLog(ygl::LOG_WARNING, "Cannot replace asset bundle: ", file, " : ", std::strerror(errno));
+		std::remove(temporary.c_str());
+	}
+}
+
+AssetBundle AssetBundle::loadOrBuild(const std::string &file) {
+	AssetBundle bundle;
+	if (bundle.load(file)) return bundle;
+
+	dbLog(ygl::LOG_INFO, "building asset bundle ", file);
+	bundle.build();
+	bundle.save(file);
+	return bundle;
+}
+
+const AssetBundle::Image &AssetBundle::getImage(const std::string &name) {
+	auto it = images.find(name);
+	if (it == images.end()) {
+		dbLog(ygl::LOG_ERROR, "Missing image in the asset bundle: ", name);
+		THROW_RUNTIME_ERR("image is not in the asset bundle");
+	}
+	return it->second;
+}
+
+const AssetBundle::Blob &AssetBundle::getBlob(const std::string &name) {
+	auto it = blobs.find(name);
+	if (it == blobs.end()) {
+		dbLog(ygl::LOG_ERROR, "Missing file in the asset bundle: ", name);
+		THROW_RUNTIME_ERR("file is not in the asset bundle");
+	}
+	return it->second;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <yoghurtgl.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// the files the game needs at startup, packed in one file that is read in one go.
+// images are stored decoded, so that a start from the bundle does not run the PNG decoder at all
+class AssetBundle {
+   public:
+	// RGBA8 texels, bottom row first like the map texture and like ygl loads image files, ready to be uploaded
+	struct Image {
+		int		 width = 0, height = 0;
+		uint8_t *texels = nullptr;
+	};
+
+	struct Blob {
+		uint8_t	   *data = nullptr;
+		std::size_t size = 0;
+	};
+
+	static const char *defaultFile;
+
+	// source files that go into the bundle, the names are also the keys for getImage() and getBlob()
+	static const std::vector<std::string> imageFiles;
+	static const std::vector<std::string> blobFiles;
+
+   private:
+	enum EntryType : uint32_t { IMAGE, BLOB };
+
+	static constexpr char	  magic[4] = {'P', 'M', 'A', 'B'};
+	static constexpr uint32_t version  = 1;
+
+	// the whole bundle, exactly as it is on disk. Images and blobs point inside it
+	std::vector<uint8_t> contents;
+
+	std::unordered_map<std::string, Image> images;
+	std::unordered_map<std::string, Blob>  blobs;
+
+	bool parse();
+
+   public:
+	AssetBundle() = default;
+	// images and blobs point inside contents, which survives a move but not a copy
+	AssetBundle(AssetBundle &&)				 = default;
+	AssetBundle &operator=(AssetBundle &&)	 = default;
+	AssetBundle(const AssetBundle &)		 = delete;
+	AssetBundle &operator=(const AssetBundle &) = delete;
+
+	// reads the bundle with a single read. Returns false if it is missing, damaged or older than a source file
+	bool load(const std::string &file);
+	// decodes the source files, the images in parallel on worker threads
+	void build();
+	// writes what was loaded or built, so that the next start can use load(). The bundle is written to a
+	// temporary file first and renamed into place, so that a game starting meanwhile never reads half of it
+	void save(const std::string &file);
+
+	// load() and falls back to build() and save() if the bundle can not be used
+	static AssetBundle loadOrBuild(const std::string &file);
+
+	const Image &getImage(const std::string &name);
+	const Blob	&getBlob(const std::string &name);
+};
@@ -0,0 +1,161 @@
+#include "differential-harness.h"
+
+#include <sstream>
+
+DifferentialHarness::DifferentialHarness() { reference.fixedSizeFastPath = false; }
+
+std::string DifferentialHarness::generateMap(std::mt19937 &rng, std::size_t width, std::size_t height) {
+	if (width < 5 || height < 5) THROW_RUNTIME_ERR("generated maps must be at least 5x5");
+
+	std::vector<std::string> rows(height, std::string(width, '#'));
+	for (std::size_t y = 1; y + 1 < height; ++y) {
+		for (std::size_t x = 1; x + 1 < width; ++x) {
+			rows[y][x] = rng() % 100 < 30 ? '#' : '.';
+		}
+		// a tunnel that wraps around the sides, like the one in the middle of the classic level
+		if (rng() % 6 == 0) rows[y][0] = rows[y][width - 1] = '.';
+	}
+
+	// special cells go anywhere inside, but not on top of each other
+	auto place = [&](char c) {
+		std::size_t x, y;
+		do {
+			x = 1 + rng() % (width - 2);
+			y = 1 + rng() % (height - 2);
+		} while (rows[y][x] != '.' && rows[y][x] != '#');
+		rows[y][x] = c;
+	};
+	place('p');
+	place('h');
+	for (std::size_t i = 1 + rng() % 4; i > 0; --i) place('g');
+	for (std::size_t i = 1 + rng() % 4; i > 0; --i) place('@');
+
+	std::string text;
+	for (std::size_t y = 0; y < height; ++y) {
+		text += rows[y];
+		if (y + 1 < height) text += '\n';
+	}
+	return text;
+}
+
+DifferentialHarness::Result DifferentialHarness::run(uint32_t seed) {
+	std::mt19937 rng(seed);
+
+	// most maps get the size of the classic level, so that its specialized BFS is used
+	bool		classicSize = rng() % 4 != 0;
+	std::size_t width		= classicSize ? classicWidth : 7 + rng() % 30;
+	std::size_t height		= classicSize ? classicHeight : 7 + rng() % 30;
+	bool		autopilot	= rng() % 2;
+
+	std::string		   level = generateMap(rng, width, height);
+	std::istringstream referenceLevel(level), candidateLevel(level);
+
+	// both games seed their random numbers from rand(), so they get the same ghost speeds
+	ygl::Scene referenceScene, candidateScene;
+	srand(seed);
+	PacmanGame *referenceGame = referenceScene.registerSystem<PacmanGame>(referenceLevel, width, height, true);
+	srand(seed);
+	PacmanGame *candidateGame = candidateScene.registerSystem<PacmanGame>(candidateLevel, width, height, true);
+
+	// settings that init() already used are the same for both games, the rest take effect now
+	referenceGame->gameSettings			  = reference;
+	candidateGame->gameSettings			  = candidate;
+	referenceGame->gameSettings.autopilot = candidateGame->gameSettings.autopilot = autopilot;
+
+	Result result;
+	auto   fail = [&](std::size_t tick, const std::string &divergence) {
+		  result.diverged	= true;
+		  result.divergence = "map " + std::to_string(seed) + " (" + std::to_string(width) + "x" +
+							  std::to_string(height) + (autopilot ? ", autopilot" : "") + "), tick " +
+							  std::to_string(tick) + ": " + divergence;
+		  return result;
+	};
+
+	std::string divergence = compare(*referenceGame, *candidateGame);
+	if (!divergence.empty()) return fail(0, divergence);
+
+	if (!autopilot) {
+		referenceGame->startGame();
+		candidateGame->startGame();
+	}
+	for (std::size_t tick = 1; tick <= ticks; ++tick) {
+		// random steering, the same for both games
+		if (!autopilot && rng() % 8 == 0) {
+			PacmanGame::Direction direction = PacmanGame::Direction(rng() % 4);
+			referenceGame->setPlayerInput(0, direction);
+			candidateGame->setPlayerInput(0, direction);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		referenceGame->tick(deltaTime);
+		auto referenceDone = std::chrono::steady_clock::now();
+		candidateGame->tick(deltaTime);
+		auto candidateDone = std::chrono::steady_clock::now();
+		result.referenceSeconds += std::chrono::duration<double>(referenceDone - start).count();
+		result.candidateSeconds += std::chrono::duration<double>(candidateDone - referenceDone).count();
+
+		divergence = compare(*referenceGame, *candidateGame);
+		if (!divergence.empty()) return fail(tick, divergence);
+		result.ticks = tick;
+
+		if (referenceGame->hasGameEnded()) break;
+	}
+	return result;
+}
+
+// describes the first difference between the two games, empty if there is none.
+// floats are compared exactly, an optimized kernel must not even change the rounding
+std::string DifferentialHarness::compare(PacmanGame &referenceGame, PacmanGame &candidateGame) {
+	std::ostringstream out;
+	std::size_t		   width = referenceGame.getWidth(), height = referenceGame.getHeight();
+
+	auto compareField = [&](const char *name, const int *a, const int *b) {
+		for (std::size_t i = 0; i < width * height; ++i) {
+			if (a[i] == b[i]) continue;
+			out << name << " at (" << i % width << ", " << i / width << "): " << a[i] << " vs " << b[i];
+			return false;
+		}
+		return true;
+	};
+	if (!compareField("distance field", referenceGame.getDistanceField(), candidateGame.getDistanceField()) ||
+		!compareField("nearest player field", referenceGame.getNearestPlayerField(),
+					  candidateGame.getNearestPlayerField())) {
+		return out.str();
+	}
+
+	std::span<const PacmanGame::PacmanEntityData> a = referenceGame.getEntityData();
+	std::span<const PacmanGame::PacmanEntityData> b = candidateGame.getEntityData();
+	if (a.size() != b.size()) {
+		out << "entity count: " << a.size() << " vs " << b.size();
+		return out.str();
+	}
+	for (std::size_t i = 0; i < a.size(); ++i) {
+		auto report = [&](const char *what, auto x, auto y) {
+			out << (a[i].isAI ? "ghost " : "pacman ") << i << ' ' << what << ": " << x << " vs " << y;
+		};
+		if (a[i].position != b[i].position) {
+			report("position x", a[i].position.x, b[i].position.x);
+			out << ", y: " << a[i].position.y << " vs " << b[i].position.y;
+		} else if (a[i].moveDirection != b[i].moveDirection) {
+			report("move direction", a[i].moveDirection, b[i].moveDirection);
+		} else if (a[i].inputDirection != b[i].inputDirection) {
+			report("input direction", a[i].inputDirection, b[i].inputDirection);
+		} else if (a[i].aiState != b[i].aiState) {
+			report("state", a[i].aiState, b[i].aiState);
+		} else if (a[i].speed != b[i].speed) {
+			report("speed", a[i].speed, b[i].speed);
+		} else if (a[i].rotation != b[i].rotation) {
+			report("rotation", a[i].rotation, b[i].rotation);
+		} else continue;
+		return out.str();
+	}
+
+	if (referenceGame.getScore() != candidateGame.getScore()) {
+		out << "score: " << referenceGame.getScore() << " vs " << candidateGame.getScore();
+	} else if (referenceGame.getLives() != candidateGame.getLives()) {
+		out << "lives: " << referenceGame.getLives() << " vs " << candidateGame.getLives();
+	} else if (referenceGame.hasGameEnded() != candidateGame.hasGameEnded()) {
+		out << "game ended: " << referenceGame.hasGameEnded() << " vs " << candidateGame.hasGameEnded();
+	}
+	return out.str();
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <string>
+
+#include "pacman-game.h"
+
+// runs two headless games side by side on the same generated map and the same random input. One uses
+// the reference settings and the other the candidate ones, which turn on the optimized kernels.
+// after every tick the distance fields and all entity states must be identical
+class DifferentialHarness {
+   public:
+	struct Result {
+		bool		diverged = false;
+		std::string divergence;	    // what differed first, empty if nothing did
+		std::size_t ticks = 0;		// ticks that matched
+		double		referenceSeconds = 0, candidateSeconds = 0;	    // time spent in tick() by each game
+	};
+
+	PacmanGameSettings reference;
+	PacmanGameSettings candidate;
+	std::size_t		   ticks	 = 3000;
+	float			   deltaTime = 1 / 120.f;
+
+	// the reference has every fast path turned off, the candidate uses the defaults
+	DifferentialHarness();
+
+	// one game pair on a map generated from seed
+	Result run(uint32_t seed);
+
+	// a random maze with walls around it, tunnels on the sides, one pacman, a ghost home and a few ghosts
+	static std::string generateMap(std::mt19937 &rng, std::size_t width, std::size_t height);
+
+   private:
+	std::string compare(PacmanGame &referenceGame, PacmanGame &candidateGame);
+};
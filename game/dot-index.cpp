@@ -0,0 +1,79 @@
+#include "dot-index.h"
+
+#include <cstdlib>
+#include <climits>
+
+void DotIndex::build(char **map, std::size_t width, std::size_t height, std::size_t bucketSize) {
+	this->map		 = map;
+	this->width		 = width;
+	this->height	 = height;
+	this->bucketSize = bucketSize;
+	bucketsX		 = (width + bucketSize - 1) / bucketSize;
+	bucketsY		 = (height + bucketSize - 1) / bucketSize;
+
+	counts.assign(bucketsX * bucketsY, 0);
+	total = 0;
+	for (std::size_t y = 0; y < height; ++y) {
+		for (std::size_t x = 0; x < width; ++x) {
+			if (isDot(map[y][x])) {
+				++counts[(y / bucketSize) * bucketsX + x / bucketSize];
+				++total;
+			}
+		}
+	}
+}
+
+void DotIndex::remove(glm::ivec2 position) {
+	unsigned int &count = counts[(position.y / bucketSize) * bucketsX + position.x / bucketSize];
+	if (count == 0) return;
+	--count;
+	--total;
+}
+
+// looks at all cells of a bucket and updates best if a closer dot is found
+void DotIndex::scanBucket(std::size_t bx, std::size_t by, glm::ivec2 from, int **areas, int &bestDistance,
+						  glm::ivec2 &best) const {
+	if (counts[by * bucketsX + bx] == 0) return;
+	std::size_t endY = std::min((by + 1) * bucketSize, height);
+	std::size_t endX = std::min((bx + 1) * bucketSize, width);
+	for (std::size_t y = by * bucketSize; y < endY; ++y) {
+		for (std::size_t x = bx * bucketSize; x < endX; ++x) {
+			if (!isDot(map[y][x])) continue;
+			if (areas && areas[y][x] != areas[from.y][from.x]) continue;
+			int distance = std::abs(int(x) - from.x) + std::abs(int(y) - from.y);
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				best		 = glm::ivec2(x, y);
+			}
+		}
+	}
+}
+
+// visits the buckets in growing square rings around the start, until no ring can contain anything closer
+glm::ivec2 DotIndex::nearest(glm::ivec2 from, int **areas) const {
+	glm::ivec2 best(-1, -1);
+	if (total == 0) return best;
+
+	int bestDistance = INT_MAX;
+	int startX		 = from.x / int(bucketSize);
+	int startY		 = from.y / int(bucketSize);
+	int maxRing		 = std::max(bucketsX, bucketsY);
+
+	for (int ring = 0; ring <= maxRing; ++ring) {
+		// every cell in this ring is at least this far away on one of the axes
+		if (ring > 0 && bestDistance <= (ring - 1) * int(bucketSize) + 1) break;
+
+		for (int dy = -ring; dy <= ring; ++dy) {
+			int by = startY + dy;
+			if (by < 0 || by >= int(bucketsY)) continue;
+			// inner rows of the ring only have the two side buckets
+			int step = (std::abs(dy) == ring || ring == 0) ? 1 : 2 * ring;
+			for (int dx = -ring; dx <= ring; dx += step) {
+				int bx = startX + dx;
+				if (bx < 0 || bx >= int(bucketsX)) continue;
+				scanBucket(bx, by, from, areas, bestDistance, best);
+			}
+		}
+	}
+	return best;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <yoghurtgl.h>
+
+#include <cstddef>
+#include <vector>
+
+// keeps count of the remaining dots in square buckets of the map,
+// so that the nearest dot can be found without scanning the whole map
+class DotIndex {
+	char	  **map = nullptr;
+	std::size_t width = 0, height = 0;
+	std::size_t bucketSize = 0;
+	std::size_t bucketsX = 0, bucketsY = 0;
+	std::size_t total	   = 0;
+
+	std::vector<unsigned int> counts;	  // remaining dots in each bucket
+
+	static bool isDot(char c) { return c == '.' || c == '@'; }
+
+	void scanBucket(std::size_t bx, std::size_t by, glm::ivec2 from, int **areas, int &bestDistance,
+					glm::ivec2 &best) const;
+
+   public:
+	// counts the dots on the map. The index keeps reading the map, so it must outlive this object
+	void build(char **map, std::size_t width, std::size_t height, std::size_t bucketSize = 8);
+
+	// call when a dot is eaten
+	void remove(glm::ivec2 position);
+
+	std::size_t size() const { return total; }
+
+	// the closest remaining dot by manhattan distance, (-1, -1) if there are none.
+	// if areas is given, only the dots with the same area number as from count
+	glm::ivec2 nearest(glm::ivec2 from, int **areas = nullptr) const;
+};
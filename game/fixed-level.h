@@ -0,0 +1,162 @@
+#pragma once
+#include <yoghurtgl.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+
+// levels with dimensions known at compile time
+template <std::size_t W, std::size_t H>
+struct FixedLevel {
+	static constexpr std::size_t width = W, height = H;
+
+	std::array<char, W * H> cells{};
+
+	constexpr char at(std::size_t x, std::size_t y) const { return cells[y * W + x]; }
+	constexpr bool isFree(std::size_t x, std::size_t y) const { return x < W && y < H && at(x, y) != '#'; }
+
+	// index of the first cell with the given symbol, -1 if there is none
+	constexpr int find(char c) const {
+		for (std::size_t i = 0; i < W * H; ++i) {
+			if (cells[i] == c) return i;
+		}
+		return -1;
+	}
+
+	// true if the walls of a loaded map are the same as the walls of this level
+	bool sameWalls(char **map) const {
+		for (std::size_t y = 0; y < H; ++y) {
+			for (std::size_t x = 0; x < W; ++x) {
+				if ((map[y][x] == '#') != (at(x, y) == '#')) return false;
+			}
+		}
+		return true;
+	}
+};
+
+// parses a level from text with one row per line. A malformed level does not compile
+template <std::size_t W, std::size_t H>
+constexpr FixedLevel<W, H> parseLevel(const char *text) {
+	FixedLevel<W, H> level;
+	for (std::size_t y = 0; y < H; ++y) {
+		for (std::size_t x = 0; x < W; ++x) {
+			if (*text == '\0' || *text == '\n') throw std::logic_error("level row is too short");
+			level.cells[y * W + x] = *text++;
+		}
+		if (*text == '\n') ++text;
+	}
+	return level;
+}
+
+// BFS from the cell with index start, -1 for unreachable cells. Same as PacmanGame::fillDistanceMap
+template <std::size_t W, std::size_t H>
+constexpr std::array<int, W * H> computeDistanceField(const FixedLevel<W, H> &level, int start) {
+	std::array<int, W * H> distance{};
+	std::array<int, W * H> queue{};
+	std::fill(distance.begin(), distance.end(), -1);
+
+	std::size_t front = 0, back = 0;
+	distance[start] = 0;
+	queue[back++]	= start;
+	while (front != back) {
+		int			index = queue[front++];
+		std::size_t x = index % W, y = index / W;
+		// up, down, left, right
+		const int dx[] = {0, 0, -1, 1};
+		const int dy[] = {-1, 1, 0, 0};
+		for (int i = 0; i < 4; ++i) {
+			std::size_t nx = x + dx[i], ny = y + dy[i];
+			if (!level.isFree(nx, ny) || distance[ny * W + nx] != -1) continue;
+			distance[ny * W + nx] = distance[index] + 1;
+			queue[back++]		  = ny * W + nx;
+		}
+	}
+	return distance;
+}
+
+// the level from resources/map.txt
+inline constexpr std::size_t classicWidth  = 21;
+inline constexpr std::size_t classicHeight = 22;
+
+inline constexpr FixedLevel<classicWidth, classicHeight> classicLevel = parseLevel<classicWidth, classicHeight>(
+	"#####################\n"
+	"#.........#.........#\n"
+	"#@##.####.#.####.##@#\n"
+	"#.##.####.#.####.##.#\n"
+	"#...................#\n"
+	"#.##.#.#######.#.##.#\n"
+	"#....#....#....#....#\n"
+	"####.####.#.####.####\n"
+	"   #.#.........#.#   \n"
+	"####.#.### ###.#.####\n"
+	".......#gghgg#.......\n"
+	"####.#.#######.#.####\n"
+	"   #.#....p....#.#   \n"
+	"####.#.#######.#.####\n"
+	"#.........#.........#\n"
+	"#.##.####.#.####.##.#\n"
+	"#@.#.............#.@#\n"
+	"##.#.#.#######.#.#.##\n"
+	"#....#....#....#....#\n"
+	"#.#######.#.#######.#\n"
+	"#...................#\n"
+	"#####################");
+
+// the distance field to the ghost home never changes, so it is computed by the compiler
+inline constexpr std::array<int, classicWidth * classicHeight> classicHomeDistance =
+	computeDistanceField(classicLevel, classicLevel.find('h'));
+
+// BFS for a map with fixed dimensions. The constant bounds let the compiler unroll the clearing and turn
+// the index arithmetic into constants, and the whole state fits in a few kilobytes.
+// produces exactly the same fields as PacmanGame::fillDistanceMap
+template <std::size_t W, std::size_t H>
+class FixedFlowField {
+	static_assert(W * H <= UINT16_MAX, "cell indices must fit in the queue");
+
+	std::array<bool, W * H>		free{};
+	std::array<uint16_t, W * H> queue{};
+
+   public:
+	// the walls never change, so they are copied once
+	void setWalls(char **map) {
+		for (std::size_t y = 0; y < H; ++y) {
+			for (std::size_t x = 0; x < W; ++x) {
+				free[y * W + x] = map[y][x] != '#';
+			}
+		}
+	}
+
+	// distance and nearest must point to contiguous W * H arrays. nearest may be null
+	void fill(int *distance, int *nearest, std::span<const glm::ivec2> starts) {
+		std::fill_n(distance, W * H, -1);
+		if (nearest) std::fill_n(nearest, W * H, -1);
+
+		std::size_t front = 0, back = 0;
+		for (std::size_t i = 0; i < starts.size(); ++i) {
+			std::size_t index = starts[i].y * W + starts[i].x;
+			if (distance[index] != -1) continue;
+			distance[index] = 0;
+			if (nearest) nearest[index] = i;
+			queue[back++] = index;
+		}
+
+		auto step = [&](std::size_t from, std::size_t to) {
+			if (!free[to] || distance[to] != -1) return;
+			distance[to] = distance[from] + 1;
+			if (nearest) nearest[to] = nearest[from];
+			queue[back++] = to;
+		};
+
+		while (front != back) {
+			std::size_t index = queue[front++];
+			std::size_t x	  = index % W;
+			// same order as the generic BFS, so that ties between players are broken the same way
+			if (index >= W) step(index, index - W);				  // up
+			if (index + W < W * H) step(index, index + W);		  // down
+			if (x > 0) step(index, index - 1);					  // left
+			if (x + 1 < W) step(index, index + 1);				  // right
+		}
+	}
+};
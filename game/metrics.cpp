@@ -0,0 +1,311 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#ifndef _WIN32
+	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+#endif
+
+void FrameTimeHistogram::record(double milliseconds) {
+	std::size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), milliseconds) - bounds.begin();
+	counts[bucket].fetch_add(1, std::memory_order_relaxed);
+	sumMicroseconds.fetch_add(uint64_t(milliseconds * 1000), std::memory_order_relaxed);
+}
+
+FrameTimeHistogram::Snapshot FrameTimeHistogram::read() const {
+	Snapshot snapshot;
+	for (std::size_t i = 0; i < bucketsCount; ++i) {
+		snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+	}
+	snapshot.sumMicroseconds = sumMicroseconds.load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+uint64_t FrameTimeHistogram::Snapshot::total() const {
+	uint64_t total = 0;
+	for (uint64_t count : counts) total += count;
+	return total;
+}
+
+double FrameTimeHistogram::Snapshot::percentile(double p) const {
+	uint64_t total = this->total();
+	if (total == 0) return 0;
+
+	double rank		  = p * total;
+	double cumulative = 0;
+	for (std::size_t i = 0; i < bucketsCount; ++i) {
+		if (counts[i] == 0 || cumulative + counts[i] < rank) {
+			cumulative += counts[i];
+			continue;
+		}
+		// the last bucket has no upper bound, the best guess is its lower one
+		if (i == bounds.size()) return bounds.back();
+		double lower = i == 0 ? 0 : bounds[i - 1];
+		return lower + (bounds[i] - lower) * (rank - cumulative) / counts[i];
+	}
+	return bounds.back();
+}
+
+FrameTimeHistogram::Snapshot FrameTimeHistogram::Snapshot::operator-(const Snapshot &other) const {
+	Snapshot difference;
+	for (std::size_t i = 0; i < bucketsCount; ++i) {
+		difference.counts[i] = counts[i] - other.counts[i];
+	}
+	difference.sumMicroseconds = sumMicroseconds - other.sumMicroseconds;
+	return difference;
+}
+
+MetricsSink::MetricsSink(GameMetrics &metrics, const Settings &settings)
+	: metrics(metrics), settings(settings), startTime(std::chrono::steady_clock::now()) {
+	if (this->settings.gameId.empty()) {
+#ifndef _WIN32
+		this->settings.gameId = std::to_string(getpid());
+#else
+		this->settings.gameId = "0";
+#endif
+	}
+	if (this->settings.interval.count() <= 0) THROW_RUNTIME_ERR("the metrics interval must be positive");
+
+	if (settings.format == JSONL) {
+		out.open(settings.file, std::ios::app);
+		if (!out) {
+			dbLog(ygl::LOG_ERROR, "Cannot open metrics file: ", settings.file, " : ", std::strerror(errno));
+			return;
+		}
+		out << std::boolalpha;
+	} else if (!openSocket()) return;
+
+	thread = std::thread(&MetricsSink::run, this);
+}
+
+MetricsSink::~MetricsSink() {
+	{
+		std::lock_guard lock(mutex);
+		running = false;
+	}
+	stopped.notify_all();
+	if (thread.joinable()) thread.join();
+#ifndef _WIN32
+	if (listenSocket != -1) close(listenSocket);
+#endif
+}
+
+MetricsSink::Sample MetricsSink::take() {
+	auto   load = [](const GameMetrics::Counter &counter) { return counter.load(std::memory_order_relaxed); };
+	Sample sample;
+	sample.time			  = std::chrono::steady_clock::now();
+	sample.ticks		  = load(metrics.ticks);
+	sample.bfsCalls		  = load(metrics.bfsCalls);
+	sample.bfsNanoseconds = load(metrics.bfsNanoseconds);
+	sample.dotsEaten	  = load(metrics.dotsEaten);
+	sample.pillsEaten	  = load(metrics.pillsEaten);
+	sample.deaths		  = load(metrics.deaths);
+	sample.ghostsEaten	  = load(metrics.ghostsEaten);
+	for (std::size_t i = 0; i < GameMetrics::ghostStatesCount; ++i) {
+		sample.ghostTransitions[i] = load(metrics.ghostTransitions[i]);
+	}
+	for (std::size_t i = 0; i < GameMetrics::aiLevelsCount; ++i) {
+		sample.ghostUpdates[i] = load(metrics.ghostUpdates[i]);
+	}
+	sample.score		  = load(metrics.score);
+	sample.lives		  = load(metrics.lives);
+	sample.ended		  = metrics.ended.load(std::memory_order_relaxed);
+	sample.frameTimes	  = metrics.frameTimes.read();
+	sample.inputToState	  = metrics.inputToState.read();
+	sample.inputToPresent = metrics.inputToPresent.read();
+	return sample;
+}
+
+void MetricsSink::run() {
+	Sample previous = take();
+	auto   next		= previous.time + settings.interval;
+	while (running) {
+		if (settings.format == PROMETHEUS) serve(next);
+		else {
+			std::unique_lock lock(mutex);
+			stopped.wait_until(lock, next, [this] { return !running; });
+		}
+		if (!running) break;
+
+		if (settings.format == JSONL) {
+			Sample sample = take();
+			writeJsonLine(sample, previous, false);
+			previous = sample;
+		}
+		next += settings.interval;
+	}
+
+	if (settings.format == JSONL) writeJsonLine(take(), previous, true);
+}
+
+// one object per line, with the counters of the last interval and the totals of the game so far
+void MetricsSink::writeJsonLine(const Sample &sample, const Sample &previous, bool final) {
+	auto   millis	= [](auto duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+	double interval = millis(sample.time - previous.time);
+	auto   unixTime =
+		std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+	Sample gameStart{};
+	gameStart.time = startTime;
+
+	out << "{\"game\":\"" << settings.gameId << "\",\"time_ms\":" << unixTime.count() << ",\"final\":" << final
+		<< ",\"interval_ms\":" << interval
+		<< ",\"ticks_per_sec\":" << (interval > 0 ? (sample.ticks - previous.ticks) * 1000. / interval : 0.)
+		<< ",\"interval\":";
+	writeJsonCounters(sample, previous);
+	out << ",\"totals\":";
+	writeJsonCounters(sample, gameStart);
+	out << ",\"score\":" << sample.score << ",\"lives\":" << sample.lives << ",\"ended\":" << sample.ended << "}\n";
+	out.flush();
+}
+
+void MetricsSink::writeJsonCounters(const Sample &sample, const Sample &previous) {
+	auto percentiles = [this](const FrameTimeHistogram::Snapshot &histogram) {
+		out << "{\"p50\":" << histogram.percentile(0.5) << ",\"p90\":" << histogram.percentile(0.9)
+			<< ",\"p99\":" << histogram.percentile(0.99) << '}';
+	};
+	FrameTimeHistogram::Snapshot frames = sample.frameTimes - previous.frameTimes;
+	FrameTimeHistogram::Snapshot inputs = sample.inputToPresent - previous.inputToPresent;
+
+	out << "{\"ticks\":" << sample.ticks - previous.ticks
+		<< ",\"bfs_calls\":" << sample.bfsCalls - previous.bfsCalls
+		<< ",\"bfs_ms\":" << (sample.bfsNanoseconds - previous.bfsNanoseconds) / 1e6
+		<< ",\"dots_eaten\":" << sample.dotsEaten - previous.dotsEaten
+		<< ",\"pills_eaten\":" << sample.pillsEaten - previous.pillsEaten
+		<< ",\"deaths\":" << sample.deaths - previous.deaths
+		<< ",\"ghosts_eaten\":" << sample.ghostsEaten - previous.ghostsEaten << ",\"ghost_transitions\":{";
+	for (std::size_t i = 0; i < GameMetrics::ghostStatesCount; ++i) {
+		out << (i ? "," : "") << '"' << GameMetrics::ghostStateNames[i]
+			<< "\":" << sample.ghostTransitions[i] - previous.ghostTransitions[i];
+	}
+	out << "},\"ghost_updates\":{";
+	for (std::size_t i = 0; i < GameMetrics::aiLevelsCount; ++i) {
+		out << (i ? "," : "") << '"' << GameMetrics::aiLevelNames[i]
+			<< "\":" << sample.ghostUpdates[i] - previous.ghostUpdates[i];
+	}
+	out << "},\"frames\":" << frames.total() << ",\"frame_ms\":";
+	percentiles(frames);
+	out << ",\"inputs\":" << inputs.total() << ",\"input_to_state_ms\":";
+	percentiles(sample.inputToState - previous.inputToState);
+	out << ",\"input_to_present_ms\":";
+	percentiles(inputs);
+	out << '}';
+}
+
+// text exposition format, see https://prometheus.io/docs/instrumenting/exposition_formats/
+std::string MetricsSink::prometheusText(const Sample &sample) {
+	std::ostringstream text;
+	std::string		   label = "game=\"" + settings.gameId + "\"";
+
+	auto metric = [&](const char *name, const char *type, const char *help, auto value) {
+		text << "# HELP pacman_" << name << ' ' << help << "\n# TYPE pacman_" << name << ' ' << type << '\n'
+			 << "pacman_" << name << '{' << label << "} " << value << '\n';
+	};
+	metric("ticks_total", "counter", "Simulation ticks.", sample.ticks);
+	metric("bfs_calls_total", "counter", "Flow field recalculations.", sample.bfsCalls);
+	metric("bfs_seconds_total", "counter", "Time spent in flow field recalculations.", sample.bfsNanoseconds / 1e9);
+	metric("dots_eaten_total", "counter", "Dots eaten, pills included.", sample.dotsEaten);
+	metric("pills_eaten_total", "counter", "Pills eaten.", sample.pillsEaten);
+	metric("deaths_total", "counter", "Lives lost.", sample.deaths);
+	metric("ghosts_eaten_total", "counter", "Ghosts eaten while scared.", sample.ghostsEaten);
+	metric("score", "gauge", "Current score.", sample.score);
+	metric("lives", "gauge", "Lives left.", sample.lives);
+	metric("ended", "gauge", "1 if the game has ended.", int(sample.ended));
+
+	text << "# HELP pacman_ghost_transitions_total Ghost state changes, by the entered state.\n"
+		 << "# TYPE pacman_ghost_transitions_total counter\n";
+	for (std::size_t i = 0; i < GameMetrics::ghostStatesCount; ++i) {
+		text << "pacman_ghost_transitions_total{" << label << ",state=\"" << GameMetrics::ghostStateNames[i]
+			 << "\"} " << sample.ghostTransitions[i] << '\n';
+	}
+
+	text << "# HELP pacman_ghost_updates_total Ghost updates, by the level of detail of the AI.\n"
+		 << "# TYPE pacman_ghost_updates_total counter\n";
+	for (std::size_t i = 0; i < GameMetrics::aiLevelsCount; ++i) {
+		text << "pacman_ghost_updates_total{" << label << ",level=\"" << GameMetrics::aiLevelNames[i] << "\"} "
+			 << sample.ghostUpdates[i] << '\n';
+	}
+
+	auto histogram = [&](const char *name, const char *help, const FrameTimeHistogram::Snapshot &values) {
+		text << "# HELP pacman_" << name << ' ' << help << "\n# TYPE pacman_" << name << " histogram\n";
+		uint64_t cumulative = 0;
+		for (std::size_t i = 0; i < FrameTimeHistogram::bucketsCount; ++i) {
+			cumulative += values.counts[i];
+			text << "pacman_" << name << "_bucket{" << label << ",le=\"";
+			if (i < FrameTimeHistogram::bounds.size()) text << FrameTimeHistogram::bounds[i] / 1000;
+			else text << "+Inf";
+			text << "\"} " << cumulative << '\n';
+		}
+		text << "pacman_" << name << "_sum{" << label << "} " << values.sumMicroseconds / 1e6 << '\n'
+			 << "pacman_" << name << "_count{" << label << "} " << cumulative << '\n';
+	};
+	histogram("frame_seconds", "Time between rendered frames.", sample.frameTimes);
+	histogram("input_to_state_seconds", "Time from a key press to the tick in which pacman turns.",
+			  sample.inputToState);
+	histogram("input_to_present_seconds", "Time from a key press to the first frame that shows the turn.",
+			  sample.inputToPresent);
+	return text.str();
+}
+
+#ifndef _WIN32
+bool MetricsSink::openSocket() {
+	listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenSocket == -1) {
+		dbLog(ygl::LOG_ERROR, "Cannot create metrics socket: ", std::strerror(errno));
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	sockaddr_in address{};
+	address.sin_family		= AF_INET;
+	address.sin_port		= htons(settings.port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) == -1 || listen(listenSocket, 4) == -1) {
+		dbLog(ygl::LOG_ERROR, "Cannot listen for metrics on port ", settings.port, " : ", std::strerror(errno));
+		close(listenSocket);
+		listenSocket = -1;
+		return false;
+	}
+	return true;
+}
+
+// answers scrapes until the given time. Every request gets the page, whatever its path
+void MetricsSink::serve(std::chrono::steady_clock::time_point until) {
+	while (running) {
+		auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(until - std::chrono::steady_clock::now());
+		if (remaining.count() <= 0) return;
+
+		// short waits, so that stopping the sink does not hang
+		pollfd listening{listenSocket, POLLIN, 0};
+		if (poll(&listening, 1, std::min<int>(remaining.count(), 100)) <= 0) continue;
+
+		int client = accept(listenSocket, nullptr, nullptr);
+		if (client == -1) continue;
+		timeval timeout{0, 100000};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		char request[1024];
+		recv(client, request, sizeof(request), 0);
+
+		std::string body	 = prometheusText(take());
+		std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+							   std::to_string(body.size()) + "\r\n\r\n" + body;
+		send(client, response.data(), response.size(), MSG_NOSIGNAL);
+		close(client);
+	}
+}
+#else
+bool MetricsSink::openSocket() {
+	dbLog(ygl::LOG_ERROR, "the Prometheus metrics endpoint is not supported on Windows");
+	return false;
+}
+
+void MetricsSink::serve(std::chrono::steady_clock::time_point) {}
+#endif
@@ -0,0 +1,128 @@
+#pragma once
+#include <yoghurtgl.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// histogram of frame times and input latencies with fixed buckets. Recording is a single relaxed increment
+class FrameTimeHistogram {
+   public:
+	// upper bounds of the buckets in ms, the last bucket has no upper bound
+	static constexpr std::array<double, 16> bounds = {1, 2, 4, 6, 8, 10, 12, 14, 16, 17, 20, 25, 33, 50, 100, 250};
+	static constexpr std::size_t			bucketsCount = bounds.size() + 1;
+
+	struct Snapshot {
+		std::array<uint64_t, bucketsCount> counts{};
+		uint64_t						   sumMicroseconds = 0;
+
+		uint64_t total() const;
+		// interpolated inside the bucket, like Prometheus' histogram_quantile()
+		double	 percentile(double p) const;
+		Snapshot operator-(const Snapshot &other) const;
+	};
+
+   private:
+	std::array<std::atomic<uint64_t>, bucketsCount> counts{};
+	std::atomic<uint64_t>							sumMicroseconds = 0;
+
+   public:
+	void	 record(double milliseconds);
+	Snapshot read() const;
+};
+
+// counters of one game. The game threads only do relaxed increments, MetricsSink reads them from its own thread
+struct GameMetrics {
+	using Counter = std::atomic<uint64_t>;
+
+	// indexed by PacmanGame::State
+	static constexpr std::size_t ghostStatesCount = 4;
+	static constexpr const char *ghostStateNames[ghostStatesCount] = {"stay", "chase", "run", "go_home"};
+	// indexed by PacmanGame::AILevel
+	static constexpr std::size_t aiLevelsCount = 4;
+	static constexpr const char *aiLevelNames[aiLevelsCount] = {"full", "reduced", "idle", "deferred"};
+
+	Counter ticks			 = 0;
+	Counter bfsCalls		 = 0;
+	Counter bfsNanoseconds	 = 0;
+	Counter dotsEaten		 = 0;
+	Counter pillsEaten		 = 0;
+	Counter deaths			 = 0;
+	Counter ghostsEaten		 = 0;
+	Counter ghostTransitions[ghostStatesCount]{};	  // by the state that the ghost enters
+	Counter ghostUpdates[aiLevelsCount]{};			  // ghost ticks, by the level of detail of the AI
+
+	// gauges
+	std::atomic<uint64_t> score = 0;
+	std::atomic<uint64_t> lives = 0;
+	std::atomic<bool>	  ended = false;
+
+	FrameTimeHistogram frameTimes;
+	FrameTimeHistogram inputToState;		// from a key press to the tick in which pacman turns
+	FrameTimeHistogram inputToPresent;		// from a key press to the first frame that shows the turn
+
+	static void add(Counter &counter, uint64_t amount = 1) { counter.fetch_add(amount, std::memory_order_relaxed); }
+	static void set(std::atomic<uint64_t> &gauge, uint64_t value) { gauge.store(value, std::memory_order_relaxed); }
+};
+
+// periodically writes the metrics of a game from a background thread, either as one JSON object per line
+// in a file or as a Prometheus text-format page served on localhost
+class MetricsSink {
+   public:
+	enum Format { JSONL, PROMETHEUS };
+
+	struct Settings {
+		Format					  format = JSONL;
+		std::string				  file	 = "./metrics.jsonl";	  // JSONL only, lines are appended
+		uint16_t				  port	 = 9464;				  // Prometheus only, bound to 127.0.0.1
+		std::chrono::milliseconds interval{1000};
+		std::string				  gameId;	  // label of the game, the process id if empty
+	};
+
+   private:
+	// plain copy of the counters at one point in time
+	struct Sample {
+		std::chrono::steady_clock::time_point time;
+		uint64_t							  ticks, bfsCalls, bfsNanoseconds, dotsEaten, pillsEaten, deaths, ghostsEaten;
+		uint64_t							  ghostTransitions[GameMetrics::ghostStatesCount];
+		uint64_t							  ghostUpdates[GameMetrics::aiLevelsCount];
+		uint64_t							  score, lives;
+		bool								  ended;
+		FrameTimeHistogram::Snapshot		  frameTimes, inputToState, inputToPresent;
+	};
+
+	GameMetrics &metrics;
+	Settings	 settings;
+
+	std::ofstream out;
+	int			  listenSocket = -1;
+
+	std::chrono::steady_clock::time_point startTime;
+	std::thread							  thread;
+	std::mutex							  mutex;
+	std::condition_variable				  stopped;
+	std::atomic<bool>					  running = true;
+
+	Sample take();
+	void   run();
+	void   writeJsonLine(const Sample &sample, const Sample &previous, bool final);
+	void   writeJsonCounters(const Sample &sample, const Sample &previous);
+
+	std::string prometheusText(const Sample &sample);
+	bool		openSocket();
+	void		serve(std::chrono::steady_clock::time_point until);
+
+   public:
+	MetricsSink(GameMetrics &metrics, const Settings &settings);
+	// stops the thread. The JSONL sink writes a last line with the totals of the game
+	~MetricsSink();
+
+	MetricsSink(const MetricsSink &)			= delete;
+	MetricsSink &operator=(const MetricsSink &) = delete;
+};
@@ -5,27 +5,26 @@
 
 #include <glm/gtx/string_cast.hpp>
 
-const char *PacmanGame::name				   = "PacmanGame";
-const char *PacmanGame::PacmanEntityData::name = "PacmanGame::PacmanEntity";
+const char *PacmanGame::name			   = "PacmanGame";
+const char *PacmanGame::PacmanEntity::name = "PacmanGame::PacmanEntity";
 
 // utility functions to create 2d dynamic arrays
-// it will be faster to use 1d arrays and index them differently, but for a small map it does not matter
+// all rows live in one block, so map[0] can also be used as a 1d array of width * height elements
 
 template <class T>
 T **makeMap(std::size_t width, std::size_t height, const T &def) {
 	T **map = new T *[height];
-	for (std::size_t i = 0; i < height; ++i) {
-		map[i] = new T[width];
-		memset(map[i], def, width * sizeof(T));
+	map[0]	= new T[width * height];
+	memset(map[0], def, width * height * sizeof(T));
+	for (std::size_t i = 1; i < height; ++i) {
+		map[i] = map[0] + i * width;
 	}
 	return map;
 }
 
 template <class T>
-void deleteMap(T **map, std::size_t width, std::size_t height) {
-	for (std::size_t i = 0; i < height; ++i) {
-		delete[] map[i];
-	}
+void deleteMap(T **map) {
+	delete[] map[0];
 	delete[] map;
 }
 
@@ -34,34 +33,74 @@ T &get(T **arr, glm::ivec2 pos) {
 	return arr[pos.y][pos.x];
 }
 
-PacmanGame::PacmanGame(ygl::Scene *scene, const std::string &map_file, std::size_t width, std::size_t height)
-	: ISystem(scene), width(width), height(height) {
+PacmanGame::PacmanGame(ygl::Scene *scene, const std::string &map_file, std::size_t width, std::size_t height,
+					   bool headless)
+	: ISystem(scene), width(width), height(height), headless(headless), rng(rand()) {
+	constructionTime = std::chrono::steady_clock::now();
 	std::ifstream in(map_file);
 
 	if (!in) { dbLog(ygl::LOG_ERROR, "Cannot open file: ", map_file, " : ", std::strerror(errno)); }
 
-	map = new char *[height];
+	create(in);
+}
+
+PacmanGame::PacmanGame(ygl::Scene *scene, std::istream &level, std::size_t width, std::size_t height, bool headless)
+	: ISystem(scene), width(width), height(height), headless(headless), rng(rand()) {
+	constructionTime = std::chrono::steady_clock::now();
+	create(level);
+}
+
+// the part of the constructors after the map is opened
+void PacmanGame::create(std::istream &in) {
+	if (!headless) assetsLoading = std::async(std::launch::async, AssetBundle::loadOrBuild, AssetBundle::defaultFile);
+
+	map = makeMap<char>(width + 1, height, 0);
 	for (std::size_t i = 0; i < height; ++i) {
-		map[i] = new char[width + 1];
 		in.getline(map[i], width + 1, '\n');
 		if (strlen(map[i]) < width) THROW_RUNTIME_ERR("Incorrect input dimensions or corrupted map file");
 	}
 	if (!in.eof()) dbLog(ygl::LOG_WARNING, "did not read the entire map file!!");
-	in.close();
 
 	// initialize distance fields
-	distanceMap		= makeMap<int>(width, height, -1);
-	homeDistanceMap = makeMap<int>(width, height, -1);
+	distanceMap		 = makeMap<int>(width, height, -1);
+	nearestPlayerMap = makeMap<int>(width, height, -1);
+	homeDistanceMap	 = makeMap<int>(width, height, -1);
+	bfsQueue.resize(width * height);
+
+	// the classic level gets a BFS specialized for its size
+	if (width == classicWidth && height == classicHeight) {
+		classicFlowField = std::make_unique<FixedFlowField<classicWidth, classicHeight>>();
+		classicFlowField->setWalls(map);
+	}
+
+	// autopilot buffers
+
+	searchStamp		= makeMap<unsigned int>(width, height, 0);
+	searchCost		= makeMap<int>(width, height, 0);
+	searchFirstStep = makeMap<char>(width, height, NONE);
+	dangerMap		= makeMap<uint64_t>(width, height, 0);
+	areaMap			= makeMap<int>(width, height, -1);
+	fillAreaMap();
+	// a cell is expanded at most once, so the queue never holds more than one entry per neighbour of each cell
+	searchQueue.reserve(4 * width * height + 1);
 
 	score	= 0;
 	lives	= gameSettings.pacmanLives;
+	GameMetrics::set(metrics.lives, lives);
+}
 
-	// load GUI font
-	ImGuiIO io = ImGui::GetIO();
-	font	   = io.Fonts->AddFontFromFileTTF("./resources/ProggyClean.ttf", 30);
+// uploads a texture from the asset bundle
+ygl::Texture2d *PacmanGame::createTexture(const std::string &file) {
+	const AssetBundle::Image &image = assets.getImage(file);
+	ygl::Texture2d *texture = new ygl::Texture2d(image.width, image.height, ygl::TextureType::SRGBA8, image.texels);
+	texture->bind();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	texture->unbind();
+	return texture;
 }
 
-// creates the map entity
+// creates the map entity. Only finds the special positions if headless
 void PacmanGame::createMap(ygl::Renderer *renderer, ygl::AssetManager *asman) {
 	// create texture data for the map renderer
 	stbi_uc *buff = new stbi_uc[width * height * 4];
@@ -70,7 +109,7 @@ void PacmanGame::createMap(ygl::Renderer *renderer, ygl::AssetManager *asman) {
 		for (std::size_t x = 0; x < width; ++x) {
 			if (map[height - y - 1][x] == '.' || map[height - y - 1][x] == '@') { ++allDots; }
 			if (map[height - y - 1][x] == 'h') homePosition = glm::ivec2(x, height - y - 1);
-			if (map[height - y - 1][x] == 'p') pacmanStartPosition = glm::ivec2(x, height - y - 1);
+			if (map[height - y - 1][x] == 'p') pacmanStartPositions.push_back(glm::ivec2(x, height - y - 1));
 
 			buff[(y * width + x) * 4 + 0] = (map[height - y - 1][x] == '@') * 255;
 			buff[(y * width + x) * 4 + 1] = (map[height - y - 1][x] == '.') * 255;
@@ -80,6 +119,13 @@ void PacmanGame::createMap(ygl::Renderer *renderer, ygl::AssetManager *asman) {
 		}
 	}
 	currentDots = allDots;
+	if (pacmanStartPositions.empty()) THROW_RUNTIME_ERR("There is no pacman on the map");
+	dots.build(map, width, height);
+
+	if (headless) {
+		delete[] buff;
+		return;
+	}
 
 	// create map texture
 	mapTexture = new ygl::Texture2d(width, height, ygl::TextureType::RGBA16F, buff);
@@ -116,170 +162,224 @@ void PacmanGame::createMap(ygl::Renderer *renderer, ygl::AssetManager *asman) {
 												ygl::RendererComponent(mapShaderIndex, quadMeshIndex, mapMatIndex));
 }
 
-// creates the player entity (Pacman)
-void PacmanGame::createPacman(ygl::Renderer *renderer, ygl::AssetManager *asman) {
-	// texture
-	ygl::Texture2d *pacmanTexture = new ygl::Texture2d("./resources/pacman.png", ygl::TextureType::SRGBA8);
-	pacmanTexture->bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	pacmanTexture->unbind();
+// creates the player entities (Pacmen), one on every 'p' on the map
+void PacmanGame::createPacmen(ygl::Renderer *renderer, ygl::AssetManager *asman) {
+	unsigned int pacmanMatIndex = -1;
+	if (!headless) {
+		// texture
+		ygl::Texture2d *pacmanTexture = createTexture("./resources/pacman.png");
+
+		// material
+		ygl::Material pacmanMat;
+		pacmanMat.use_albedo_map = 1.0;
+		pacmanMat.albedo_map	 = asman->addTexture(pacmanTexture, "pacman_texture");
+		pacmanMatIndex			 = renderer->addMaterial(pacmanMat);
+	}
 
-	// material
-	ygl::Material pacmanMat;
-	pacmanMat.use_albedo_map	= 1.0;
-	pacmanMat.albedo_map		= asman->addTexture(pacmanTexture, "pacman_texture");
-	unsigned int pacmanMatIndex = renderer->addMaterial(pacmanMat);
+	for (glm::ivec2 startPosition : pacmanStartPositions) {
+		// position
+		playerPositions.push_back(startPosition);
+		playerCellEntries.push_back({startPosition, {}, false});
+		glm::vec2 worldPlayerPosition = mapToWorld(startPosition);
 
-	// position
-	lastPlayerPosition			  = pacmanStartPosition;
-	glm::vec2 worldPlayerPosition = mapToWorld(lastPlayerPosition);
+		// creating the player entity
+		ygl::Entity pacman = scene->createEntity();
+		scene->addComponent<ygl::Transformation>(
+			pacman, ygl::Transformation(glm::vec3(worldPlayerPosition.x, worldPlayerPosition.y, 0.5)));
 
-	// creating the player entity
-	pacman = scene->createEntity();
-	scene->addComponent<ygl::Transformation>(
-		pacman, ygl::Transformation(glm::vec3(worldPlayerPosition.x, worldPlayerPosition.y, 0.5)));
+		if (!headless) {
+			scene->addComponent<ygl::RendererComponent>(pacman,
+														ygl::RendererComponent(-1, quadMeshIndex, pacmanMatIndex));
+		}
 
-	scene->addComponent<ygl::RendererComponent>(pacman, ygl::RendererComponent(-1, quadMeshIndex, pacmanMatIndex));
+		PacmanEntityData &pacmanData = addEntityData(pacman, PacmanEntityData(false, gameSettings.pacmanSpeed));
+		pacmanData.startPosition	= startPosition;
+		pacmanData.position			= worldPlayerPosition;
+		pacmanData.previousPosition = worldPlayerPosition;
+		pacmanData.matIdx			= pacmanMatIndex;
+
+		pacmen.push_back(pacman);
+	}
 
-	PacmanEntityData &pacmanData =
-		scene->addComponent<PacmanEntityData>(pacman, PacmanEntityData(false, gameSettings.pacmanSpeed));
-	pacmanData.startPosition = pacmanStartPosition;
+	if (headless) return;
 
-	// add a key callback that controlls the character and starts the game
+	// add a key callback that controlls the character and starts the game.
+	// it runs on the main thread, so it only leaves requests for the simulation thread
 	ygl::Keyboard::addKeyCallback([this](GLFWwindow *window, int key, int scancode, int action, int mods) -> void {
 		if (window != this->window->getHandle()) return;
-		if (!(this->gameStarted)) {
-			setGhostsState(CHASE);
-			this->gameStarted = true;
-		}
+		startRequested = true;
 		if (action == GLFW_PRESS) {
-			PacmanEntityData &data = scene->getComponent<PacmanEntityData>(pacman);
+			// the events are polled at the start of a frame, so this is as close to the key press as it gets
+			auto now = std::chrono::steady_clock::now();
 			switch (key) {
-				case GLFW_KEY_UP: data.inputDirection = UP; break;
-				case GLFW_KEY_DOWN: data.inputDirection = DOWN; break;
-				case GLFW_KEY_LEFT: data.inputDirection = LEFT; break;
-				case GLFW_KEY_RIGHT: data.inputDirection = RIGHT; break;
+				case GLFW_KEY_UP: queueTurn(UP, now); break;
+				case GLFW_KEY_DOWN: queueTurn(DOWN, now); break;
+				case GLFW_KEY_LEFT: queueTurn(LEFT, now); break;
+				case GLFW_KEY_RIGHT: queueTurn(RIGHT, now); break;
 			}
 		}
 		if (action == GLFW_RELEASE) {
-			if (key == GLFW_KEY_H) setGhostsState(GO_HOME);
-			if (key == GLFW_KEY_G) setGhostsState(CHASE);
-			if (key == GLFW_KEY_J) setGhostsState(RUN);
+			if (key == GLFW_KEY_H) requestedGhostState = GO_HOME;
+			if (key == GLFW_KEY_G) requestedGhostState = CHASE;
+			if (key == GLFW_KEY_J) requestedGhostState = RUN;
 		}
 	});
 }
 
 // generates random speed for a ghost
 float PacmanGame::generateGhostSpeed() {
-	return gameSettings.ghostBaseSpeed + (rand() % 10) / 10.f * gameSettings.ghostSpeedRandomCoef;
+	return gameSettings.ghostBaseSpeed + (rng() % 10) / 10.f * gameSettings.ghostSpeedRandomCoef;
 }
 
+// colors of the ghosts, they take turns
+static const std::size_t colors_count		  = 4;
+static const glm::vec3	 colors[colors_count] = {
+	  glm::vec3(236 / 255.f, 0 / 255.f, 5 / 255.f),
+	  glm::vec3(12 / 255.f, 173 / 255.f, 228 / 255.f),
+	  glm::vec3(240 / 255.f, 131 / 255.f, 0 / 255.f),
+	  glm::vec3(246 / 255.f, 156 / 255.f, 182 / 255.f),
+};
+
+std::span<const glm::vec3> PacmanGame::getGhostColors() { return colors; }
+
 // creates all the ghosts, marked on the map
 void PacmanGame::createGhosts(ygl::Renderer *renderer, ygl::AssetManager *asman) {
-	// textures
-	ygl::Texture2d *ghostTextureMask = new ygl::Texture2d("./resources/ghost_mask.png", ygl::TextureType::SRGBA8);
-	ghostTextureMask->bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	ghostTextureMask->unbind();
-	ygl::Texture2d *ghostTextureEyes = new ygl::Texture2d("./resources/ghost_eyes.png", ygl::TextureType::SRGBA8);
-	ghostTextureEyes->bind();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	ghostTextureEyes->unbind();
-	unsigned int textureMaskIndex = asman->addTexture(ghostTextureMask, "ghost_mask");
-	unsigned int textureEyesIndex = asman->addTexture(ghostTextureEyes, "ghost_eyes");
-
-	// shader
-	ygl::VFShader *ghostShader		= new ygl::VFShader("./shaders/unlit.vs", "./shaders/pacman/ghost.fs");
-	unsigned int   ghostShaderIndex = asman->addShader(ghostShader, "ghost_shader");
-
-	// materials
-	ygl::Material deadMat;	   // only eyes
-	deadMat.albedo		   = glm::vec3(1.f, 1.f, 1.f);
-	deadMat.use_albedo_map = 0.0;
-	deadMat.use_ao_map	   = 1.0;
-	deadMat.albedo_map	   = textureMaskIndex;
-	deadMat.ao_map		   = textureEyesIndex;
-	deadMatIdx			   = renderer->addMaterial(deadMat);
-
-	ygl::Material weakMat;	   // purple scared ghost
-	weakMat.albedo		   = glm::vec3(1.f, 1.f, 1.f);
-	weakMat.use_albedo_map = 1.0;
-	weakMat.use_ao_map	   = 0.0;
-	weakMat.albedo_map	   = textureMaskIndex;
-	weakMat.ao_map		   = textureEyesIndex;
-	weakMatIdx			   = renderer->addMaterial(weakMat);
-
-	const std::size_t colors_count		   = 4;
-	glm::vec3		  colors[colors_count] = {
-		glm::vec3(236 / 255.f, 0 / 255.f, 5 / 255.f),
-		glm::vec3(12 / 255.f, 173 / 255.f, 228 / 255.f),
-		glm::vec3(240 / 255.f, 131 / 255.f, 0 / 255.f),
-		glm::vec3(246 / 255.f, 156 / 255.f, 182 / 255.f),
-	};
+	if (!headless) {
+		// textures
+		ygl::Texture2d *ghostTextureMask = createTexture("./resources/ghost_mask.png");
+		ygl::Texture2d *ghostTextureEyes = createTexture("./resources/ghost_eyes.png");
+		unsigned int textureMaskIndex = asman->addTexture(ghostTextureMask, "ghost_mask");
+		unsigned int textureEyesIndex = asman->addTexture(ghostTextureEyes, "ghost_eyes");
+
+		// shader
+		ygl::VFShader *ghostShader = new ygl::VFShader("./shaders/unlit.vs", "./shaders/pacman/ghost.fs");
+		ghostShaderIndex		   = asman->addShader(ghostShader, "ghost_shader");
+
+		// materials
+		ygl::Material deadMat;	   // only eyes
+		deadMat.albedo		   = glm::vec3(1.f, 1.f, 1.f);
+		deadMat.use_albedo_map = 0.0;
+		deadMat.use_ao_map	   = 1.0;
+		deadMat.albedo_map	   = textureMaskIndex;
+		deadMat.ao_map		   = textureEyesIndex;
+		deadMatIdx			   = renderer->addMaterial(deadMat);
+
+		ygl::Material weakMat;	   // purple scared ghost
+		weakMat.albedo		   = glm::vec3(1.f, 1.f, 1.f);
+		weakMat.use_albedo_map = 1.0;
+		weakMat.use_ao_map	   = 0.0;
+		weakMat.albedo_map	   = textureMaskIndex;
+		weakMat.ao_map		   = textureEyesIndex;
+		weakMatIdx			   = renderer->addMaterial(weakMat);
+
+		// one material per color, shared by the ghosts of that color
+		for (std::size_t i = 0; i < colors_count; ++i) {
+			ygl::Material mat;
+			mat.albedo		   = colors[i];
+			mat.use_albedo_map = 1.0;
+			mat.use_ao_map	   = 1.0;
+			mat.albedo_map	   = textureMaskIndex;
+			mat.ao_map		   = textureEyesIndex;
+			ghostMatIdx[i]	   = renderer->addMaterial(mat);
+		}
+	}
 
 	// iterate over the map, find the 'g' symbols and create ghosts there
-	std::size_t count = 0;
 	for (std::size_t y = 0; y < height; ++y) {
 		for (std::size_t x = 0; x < width; ++x) {
-			if (map[y][x] == 'g') {
-				ygl::Entity ghost = scene->createEntity();
-
-				ygl::Material mat;
-				mat.albedo			= colors[count % colors_count];
-				mat.use_albedo_map	= 1.0;
-				mat.use_ao_map		= 1.0;
-				mat.albedo_map		= textureMaskIndex;
-				mat.ao_map			= textureEyesIndex;
-				unsigned int matIdx = renderer->addMaterial(mat);
-
-				scene->addComponent(ghost, ygl::Transformation(glm::vec3(mapToWorld(glm::ivec2(x, y)), 0.6f)));
-				scene->addComponent(ghost, ygl::RendererComponent(ghostShaderIndex, quadMeshIndex, matIdx));
-				PacmanEntityData &data = scene->addComponent(ghost, PacmanEntityData(true, generateGhostSpeed()));
-				data.originalMatIdx	   = matIdx;
-				data.startPosition	   = glm::ivec2(x, y);
-
-				++count;
-			}
+			if (map[y][x] == 'g') spawnGhost(glm::ivec2(x, y));
 		}
 	}
 }
 
+ygl::Entity PacmanGame::spawnGhost(glm::ivec2 position) {
+	if (!isFree(position)) THROW_RUNTIME_ERR("cannot spawn a ghost inside a wall");
+	ygl::Entity	 ghost	= scene->createEntity();
+	std::size_t	 color	= ghostCount++ % colors_count;
+	unsigned int matIdx = headless ? -1 : ghostMatIdx[color];
+
+	scene->addComponent(ghost, ygl::Transformation(glm::vec3(mapToWorld(position), 0.6f)));
+	if (!headless) {
+		scene->addComponent(ghost, ygl::RendererComponent(ghostShaderIndex, quadMeshIndex, matIdx));
+	}
+	PacmanEntityData &data = addEntityData(ghost, PacmanEntityData(true, generateGhostSpeed()));
+	data.originalMatIdx	   = matIdx;
+	data.matIdx			   = matIdx;
+	data.startPosition	   = position;
+	data.position		   = mapToWorld(position);
+	data.previousPosition  = data.position;
+	data.color			   = color;
+	return ghost;
+}
+
+void PacmanGame::removeGhost(ygl::Entity ghost) {
+	if (ghost >= packedIndex.size() || packedIndex[ghost] == noIndex) {
+		THROW_RUNTIME_ERR("the entity is not in this pacman game");
+	}
+	if (!entityData(ghost).isAI) THROW_RUNTIME_ERR("only ghosts can be removed from a pacman game");
+
+	// move the last element into the hole, so that the arrays stay packed
+	std::size_t index = packedIndex[ghost];
+	std::size_t last  = packedData.size() - 1;
+	if (index != last) {
+		packedData[index]				   = packedData[last];
+		packedEntities[index]			   = packedEntities[last];
+		packedIndex[packedEntities[index]] = index;
+	}
+	packedData.pop_back();
+	packedEntities.pop_back();
+	packedIndex[ghost] = noIndex;
+
+	scene->destroyEntity(ghost);
+}
+
+// the marker component in the scene makes the entity part of this system,
+// the state that the simulation works on is only in the packed arrays
+PacmanGame::PacmanEntityData &PacmanGame::addEntityData(ygl::Entity e, const PacmanEntityData &data) {
+	scene->addComponent<PacmanEntity>(e, PacmanEntity());
+	if (packedIndex.size() <= e) packedIndex.resize(e + 1, noIndex);
+	packedIndex[e] = packedData.size();
+	packedEntities.push_back(e);
+	packedData.push_back(data);
+	return packedData.back();
+}
+
+PacmanGame::PacmanEntityData &PacmanGame::entityData(ygl::Entity e) { return packedData[packedIndex[e]]; }
+
 // sets the state of the ghost. Synchronizes state, speed and material data
-void PacmanGame::setGhostState(ygl::Entity e, PacmanEntityData &data, std::function<State(State)> f) {
+template <class F>
+void PacmanGame::setGhostState(PacmanEntityData &data, F f) {
 	if (data.isAI) {
-		ygl::RendererComponent &rc		 = scene->getComponent<ygl::RendererComponent>(e);
-		State					newState = f(data.aiState);
+		State newState = f(data.aiState);
 		if (newState == data.aiState) return;
 		data.aiState = newState;
+		GameMetrics::add(metrics.ghostTransitions[newState]);
 		switch (data.aiState) {
 			case STAY:
-				rc.materialIndex = data.originalMatIdx;
-				data.speed		 = generateGhostSpeed();
+				data.matIdx = data.originalMatIdx;
+				data.speed	= generateGhostSpeed();
 				break;
 			case CHASE:
-				rc.materialIndex = data.originalMatIdx;
-				data.speed		 = generateGhostSpeed();
+				data.matIdx = data.originalMatIdx;
+				data.speed	= generateGhostSpeed();
 				break;
 			case RUN:
-				rc.materialIndex = weakMatIdx;
-				data.speed		 = gameSettings.weakGhostSpeed;
+				data.matIdx = weakMatIdx;
+				data.speed	= gameSettings.weakGhostSpeed;
 				break;
 			case GO_HOME:
-				rc.materialIndex = deadMatIdx;
-				data.speed		 = gameSettings.deadGhostSpeed;
+				data.matIdx = deadMatIdx;
+				data.speed	= gameSettings.deadGhostSpeed;
 				break;
 		}
 	}
 }
 
 // sets the state of all ghosts according to the function f
-void PacmanGame::setGhostsState(std::function<State(State)> f) {
-	for (ygl::Entity e : this->entities) {
-		PacmanEntityData &data = scene->getComponent<PacmanEntityData>(e);
-		setGhostState(e, data, f);
+template <class F>
+void PacmanGame::setGhostsState(F f) {
+	for (PacmanEntityData &data : packedData) {
+		setGhostState(data, f);
 	}
 }
 
@@ -289,21 +389,51 @@ void PacmanGame::setGhostsState(State state) {
 }
 
 void PacmanGame::init() {
-	// require an asset manager and a renderer
-	ygl::AssetManager *asman	= scene->getSystem<ygl::AssetManager>();
-	ygl::Renderer	  *renderer = scene->getSystem<ygl::Renderer>();
-
-	scene->registerComponent<PacmanEntityData>();
-	scene->setSystemSignature<PacmanGame, ygl::Transformation, PacmanEntityData>();
+	// require an asset manager and a renderer, unless headless
+	ygl::AssetManager *asman	= nullptr;
+	ygl::Renderer	  *renderer = nullptr;
+	window						= nullptr;
+	if (!headless) {
+		asman	 = scene->getSystem<ygl::AssetManager>();
+		renderer = scene->getSystem<ygl::Renderer>();
+		window	 = renderer->getWindow();
+	}
 
-	window = renderer->getWindow();
+	scene->registerComponent<PacmanEntity>();
+	scene->setSystemSignature<PacmanGame, ygl::Transformation, PacmanEntity>();
 
+	// the map needs no assets, so it is created while the bundle is still loading
+	auto start = std::chrono::steady_clock::now();
 	createMap(renderer, asman);
-	createPacman(renderer, asman);
+	auto mapCreated = std::chrono::steady_clock::now();
+	if (!headless) {
+		assets = assetsLoading.get();
+
+		// the atlas only borrows the font data, the bundle keeps it alive
+		const AssetBundle::Blob &fontFile = assets.getBlob("./resources/ProggyClean.ttf");
+		ImFontConfig			 fontConfig;
+		fontConfig.FontDataOwnedByAtlas = false;
+		font = ImGui::GetIO().Fonts->AddFontFromMemoryTTF(fontFile.data, int(fontFile.size), 30, &fontConfig);
+	}
+	auto assetsLoaded = std::chrono::steady_clock::now();
+	createPacmen(renderer, asman);
 	createGhosts(renderer, asman);
 
-	fillDistanceMap(distanceMap, lastPlayerPosition);
-	fillDistanceMap(homeDistanceMap, homePosition);
+	fillDistanceMap(distanceMap, nearestPlayerMap, playerPositions);
+	// the home distance field of the classic level is already computed at compile time
+	if (classicFlowField && classicLevel.sameWalls(map) &&
+		classicLevel.find('h') == int(homePosition.y * width + homePosition.x)) {
+		std::copy(classicHomeDistance.begin(), classicHomeDistance.end(), homeDistanceMap[0]);
+	} else fillDistanceMap(homeDistanceMap, homePosition);
+
+	// so that the first frames have something to show
+	publishSnapshot(std::chrono::steady_clock::now());
+
+	auto end	= std::chrono::steady_clock::now();
+	auto millis = [](auto duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+	startupTime = millis(end - constructionTime);
+	dbLog(ygl::LOG_INFO, "pacman startup: ", startupTime, "ms (map ", millis(mapCreated - start), "ms, waiting for assets ",
+		  millis(assetsLoaded - mapCreated), "ms, entities ", millis(end - assetsLoaded), "ms)");
 }
 
 // coordinate system conversions
@@ -383,13 +513,14 @@ void PacmanGame::printDistanceMap(int **distanceMap) {
 }
 
 // updates any entity, managed by this system, a ghost or player
-void PacmanGame::updatePacmanEntity(PacmanEntityData &data, ygl::Transformation &transform) {
+void PacmanGame::updatePacmanEntity(PacmanEntityData &data, float deltaTime) {
 	// renaming for convenience
 	Direction &moveDirection  = data.moveDirection;
 	Direction &inputDirection = data.inputDirection;
+	glm::vec2 &position		  = data.position;
 
 	// compute coordinates in all coordinate systems
-	glm::vec2  objectPos = glm::vec2(transform.position.x, transform.position.y);	  // world position of object
+	glm::vec2  objectPos = position;											  // world position of object
 	glm::ivec2 posOnMap	 = worldToMap(objectPos);									  // map position of object
 	glm::vec2  markerPos =
 		mapToWorld(posOnMap);	  // the rounded world coordinates, they "mark" the position on the map array
@@ -406,70 +537,91 @@ void PacmanGame::updatePacmanEntity(PacmanEntityData &data, ygl::Transformation
 
 	// make the object rotate based on movement direction
 	switch (moveDirection) {
-		case UP: transform.rotation.z = -M_PI / 2; break;
-		case DOWN: transform.rotation.z = M_PI / 2; break;
-		case LEFT: transform.rotation.z = 0; break;
-		case RIGHT: transform.rotation.z = M_PI; break;
-		case NONE: transform.rotation.z = 0; break;
+		case UP: data.rotation = -M_PI / 2; break;
+		case DOWN: data.rotation = M_PI / 2; break;
+		case LEFT: data.rotation = 0; break;
+		case RIGHT: data.rotation = M_PI; break;
+		case NONE: data.rotation = 0; break;
 	}
 
 	// move in a direction
 	glm::vec2 worldMovement = getWorldVector(moveDirection);
-	transform.position.x += worldMovement.x * data.speed * window->deltaTime;
-	transform.position.y += worldMovement.y * data.speed * window->deltaTime;
+	position.x += worldMovement.x * data.speed * deltaTime;
+	position.y += worldMovement.y * data.speed * deltaTime;
 
 	// main collision detection:
 	// if we have just passed the center of a square, then we must perform a collision check
 	if (glm::dot(objectToMarker, worldMovement) > 0.01) {
 		if (tryDirection(inputDirection, moveDirection,
 						 posOnMap)) {	  // see if the player wants to turn and if it is possible
-			transform.position.y = markerPos.y;
-			transform.position.x = markerPos.x;
+			position.y = markerPos.y;
+			position.x = markerPos.x;
 		} else if (!isFree(posOnMap, moveDirection, true)) {	 // else, see if there is a wall in front of the player
 			// note that here the outside of the map is considered empty so that portals can be used
-			transform.position.x = markerPos.x;
-			transform.position.y = markerPos.y;		// if yes, stop
-			moveDirection		 = NONE;
-			inputDirection		 = NONE;
+			position.x	   = markerPos.x;
+			position.y	   = markerPos.y;	  // if yes, stop
+			moveDirection  = NONE;
+			inputDirection = NONE;
 		}
 	}
 
 	// teleportation
-	if (transform.position.x >= width / 2.f - 0.1) { transform.position.x = -(width / 2.f) + 0.2; }
-	if (transform.position.x <= -(width / 2.f) + 0.1) { transform.position.x = width / 2.f - 0.2; }
-
-	transform.updateWorldMatrix();
+	if (position.x >= width / 2.f - 0.1) { position.x = -(width / 2.f) + 0.2; }
+	if (position.x <= -(width / 2.f) + 0.1) { position.x = width / 2.f - 0.2; }
 }
 
 // simple BFS that creates a "flow field" for the ghosts to move on
 void PacmanGame::fillDistanceMap(int **distanceMap, glm::ivec2 start) {
+	fillDistanceMap(distanceMap, nullptr, std::span<const glm::ivec2>(&start, 1));
+}
+
+// multi-source BFS: distanceMap gets the distance to the closest start and nearestMap (if given)
+// gets the index of that start. The cost is the same as a single BFS, no matter the number of starts
+void PacmanGame::fillDistanceMap(int **distanceMap, int **nearestMap, std::span<const glm::ivec2> starts) {
+	auto start = std::chrono::steady_clock::now();
+	fillDistanceMapImpl(distanceMap, nearestMap, starts);
+	GameMetrics::add(metrics.bfsCalls);
+	GameMetrics::add(metrics.bfsNanoseconds, std::chrono::nanoseconds(std::chrono::steady_clock::now() - start).count());
+}
+
+void PacmanGame::fillDistanceMapImpl(int **distanceMap, int **nearestMap, std::span<const glm::ivec2> starts) {
+	if (classicFlowField && gameSettings.fixedSizeFastPath) {
+		classicFlowField->fill(distanceMap[0], nearestMap ? nearestMap[0] : nullptr, starts);
+		return;
+	}
+
 	// clear the distance field
 	for (std::size_t i = 0; i < height; ++i) {
 		memset(distanceMap[i], -1, width * sizeof(int));
+		if (nearestMap) memset(nearestMap[i], -1, width * sizeof(int));
 	}
 
-	std::queue<glm::ivec2> q;
-	get(distanceMap, start) = 0;
-	q.push(start);
+	// the queue lives in the preallocated bfsQueue, between front and back
+	std::size_t front = 0, back = 0;
+	for (std::size_t i = 0; i < starts.size(); ++i) {
+		if (get(distanceMap, starts[i]) != -1) continue;	 // two starts on the same cell
+		get(distanceMap, starts[i]) = 0;
+		if (nearestMap) get(nearestMap, starts[i]) = i;
+		bfsQueue[back++] = starts[i];
+	}
 
-	auto bfs_step = [this, distanceMap](PacmanGame::Direction dir, glm::ivec2 pos, std::queue<glm::ivec2> &q,
-										int dist) {
+	auto bfs_step = [this, distanceMap, nearestMap, &back](PacmanGame::Direction dir, glm::ivec2 pos, int dist) {
 		glm::ivec2 neighbour = pos + getMapVector(dir);
 		if (isFree(neighbour) && get(distanceMap, neighbour) == -1) {
 			get(distanceMap, neighbour) = dist + 1;
-			q.push(neighbour);
+			if (nearestMap) get(nearestMap, neighbour) = get(nearestMap, pos);
+			bfsQueue[back++] = neighbour;
 		}
 	};
 
-	while (!q.empty()) {
-		glm::ivec2 pos	= q.front();
+	while (front != back) {
+		glm::ivec2 pos	= bfsQueue[front++];
 		int		   dist = get(distanceMap, pos);
-		q.pop();
 
-		bfs_step(UP, pos, q, dist);
-		bfs_step(DOWN, pos, q, dist);
-		bfs_step(LEFT, pos, q, dist);
-		bfs_step(RIGHT, pos, q, dist);
+		bfs_step(UP, pos, dist);
+		bfs_step(DOWN, pos, dist);
+		bfs_step(LEFT, pos, dist);
+		bfs_step(RIGHT, pos, dist);
 	}
 }
 
@@ -489,9 +641,8 @@ void run_from_target(int **distanceMap, PacmanGame::Direction dir, glm::ivec2 po
 
 // looks in the four directions and decides where the ghost should go by setting its inputDirection
 // effectively mimicking user input
-void PacmanGame::resolveAIState(
-	int **distanceMap, glm::ivec2 position, unsigned char start, PacmanEntityData &data,
-	std::function<void(int **, Direction, glm::ivec2, PacmanEntityData &, int)> tryDirection) {
+void PacmanGame::resolveAIState(int **distanceMap, glm::ivec2 position, unsigned char start, PacmanEntityData &data,
+								void (*tryDirection)(int **, Direction, glm::ivec2, PacmanEntityData &, int)) {
 	int dist = get(distanceMap, position);
 	for (std::size_t i = 0; i < 4; ++i) {
 		Direction dir = Direction((start + i) % 4);
@@ -500,8 +651,8 @@ void PacmanGame::resolveAIState(
 }
 
 // the entire ghost AI. (figuratively A four-state finite automata)
-void PacmanGame::ghostAI(ygl::Entity e, ygl::Transformation &transform, PacmanEntityData &data) {
-	glm::ivec2	  position = worldToMap(transform.position);
+void PacmanGame::ghostAI(ygl::Entity e, PacmanEntityData &data) {
+	glm::ivec2	  position = worldToMap(data.position);
 	unsigned char start = e % 4;
 
 	switch (data.aiState) {
@@ -516,41 +667,47 @@ void PacmanGame::ghostAI(ygl::Entity e, ygl::Transformation &transform, PacmanEn
 void PacmanGame::eatDot(glm::ivec2 position) {
 	// delete dot on map
 	get(map, position) = ' ';
+	dots.remove(position);
 
-	// delete dot on texture
-	mapTexture->bind(GL_TEXTURE1);
-	uchar data[] = {0, 0, 0, 255};
-	glActiveTexture(GL_TEXTURE1);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, position.x, height - position.y - 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
-	glActiveTexture(GL_TEXTURE0);
-	mapTexture->unbind(GL_TEXTURE1);
+	// delete dot on texture later, on the render thread
+	if (!headless) {
+		std::lock_guard lock(dotUpdatesMutex);
+		dotUpdates.push_back(position);
+	}
+
+	GameMetrics::add(metrics.dotsEaten);
 
 	// detect win condition
 	--currentDots;
 	if (currentDots == 0) {
 		gameEnded		= true;
 		gameFinishedWin = true;
+		metrics.ended	= true;
 	}
 }
 
-// gameplay logic for the player, without the movement.
-void PacmanGame::updatePlayer(ygl::Transformation &transform, PacmanEntityData &data) {
+// gameplay logic for a player, without the movement.
+// returns true if the player has moved to another cell and the path finding must be recalculated
+bool PacmanGame::updatePlayer(std::size_t player, PacmanEntityData &data) {
 	// update the player
-	glm::ivec2 playerPosition = worldToMap(transform.position);
-	if (playerPosition != lastPlayerPosition) {
-		// recalculate ghosts pathfinding
-		fillDistanceMap(distanceMap, playerPosition);
-		lastPlayerPosition = playerPosition;
+	glm::ivec2 playerPosition = worldToMap(data.position);
+	if (playerPosition != playerPositions[player]) {
+		// the cell was entered by the movement of the previous tick
+		char current			  = get(map, playerPosition);
+		playerCellEntries[player] = {playerPositions[player], previousTickTime, current == '.' || current == '@'};
+		playerPositions[player]	  = playerPosition;
 
 		// erase dot
-		char current = get(map, playerPosition);
 		if (current == '.') {	  // eating a dot
 			score += gameSettings.eatDotScore;
+			GameMetrics::set(metrics.score, score);
 			eatDot(playerPosition);
 		} else if (current == '@') {	 // eating a pill
 			score += gameSettings.eatPillScore;
+			GameMetrics::set(metrics.score, score);
+			GameMetrics::add(metrics.pillsEaten);
 			eatDot(playerPosition);
-			pillTimer = Timer();
+			events.schedule(gameSettings.pillEffectDuration, {GameEvent::PILL_EXPIRED, ++pillGeneration, 0});
 			// make the ghosts run
 			setGhostsState([](State state) -> State {
 				switch (state) {
@@ -559,32 +716,41 @@ void PacmanGame::updatePlayer(ygl::Transformation &transform, PacmanEntityData &
 				}
 			});
 		}
+		return true;
 	}
+	return false;
 }
 
-// check for collision between a ghost, a player or the ghosts respawn point
-void PacmanGame::checkCollision(ygl::Entity ghost, ygl::Transformation &ghostTransform, PacmanEntityData &ghostData,
-								ygl::Transformation &pacmanTransform, PacmanEntityData &pacmanData) {
+// check for collision between a ghost and a player
+void PacmanGame::checkCollision(PacmanEntityData &ghostData, PacmanEntityData &pacmanData) {
 	// calculate distance
-	glm::vec2 pacPos   = glm::vec2(pacmanTransform.position.x, pacmanTransform.position.y);
-	glm::vec2 ghostPos = glm::vec2(ghostTransform.position.x, ghostTransform.position.y);
+	glm::vec2 pacPos   = pacmanData.position;
+	glm::vec2 ghostPos = ghostData.position;
 	float	  distance = glm::distance(pacPos, ghostPos);
 
 	// if the player collides with the ghost
 	if (distance < 0.7f) {
 		if (ghostData.aiState == CHASE && !gameSettings.godMode) {
 			--lives;
+			GameMetrics::add(metrics.deaths);
+			GameMetrics::set(metrics.lives, lives);
 			restartAfterDeath();
-			if (lives == 0) { gameEnded = true; }
+			if (lives == 0) {
+				gameEnded	  = true;
+				metrics.ended = true;
+			}
 		}
 		if (ghostData.aiState == RUN) {
-			setGhostState(ghost, ghostData, [](State) { return GO_HOME; });
+			GameMetrics::add(metrics.ghostsEaten);
+			setGhostState(ghostData, [](State) { return GO_HOME; });
 		}
 	}
+}
 
-	// if the ghost has reached the spawn
-	if (glm::distance(ghostPos, mapToWorld(homePosition)) < 0.2f) {
-		setGhostState(ghost, ghostData, [](State state) {
+// a dead ghost that has reached the spawn chases again
+void PacmanGame::checkHomeReached(PacmanEntityData &ghostData) {
+	if (glm::distance(ghostData.position, mapToWorld(homePosition)) < 0.2f) {
+		setGhostState(ghostData, [](State state) {
 			switch (state) {
 				case GO_HOME: return CHASE;
 				default: return state;
@@ -593,81 +759,522 @@ void PacmanGame::checkCollision(ygl::Entity ghost, ygl::Transformation &ghostTra
 	}
 }
 
-// checks if the pill timer has run out and removes its effects if so
-void PacmanGame::checkPillTimer() {
-	if (Timer::toMs(pillTimer.elapsedNs()) > gameSettings.pillEffectDuration) {
-		setGhostsState([](State state) -> State {
-			switch (state) {
-				case RUN: return CHASE;
-				default: return state;
+// applies a scheduled effect
+void PacmanGame::fireEvent(const GameEvent &event) {
+	switch (event.type) {
+		case GameEvent::PILL_EXPIRED:
+			if (event.generation != pillGeneration) return;
+			setGhostsState([](State state) -> State {
+				switch (state) {
+					case RUN: return CHASE;
+					default: return state;
+				}
+			});
+			break;
+		case GameEvent::RELEASE_GHOST:
+			if (event.generation != lifeGeneration) return;
+			if (packedIndex[event.entity] == noIndex) return;	  // the ghost was removed
+			setGhostState(entityData(event.entity), [](State state) { return state == STAY ? CHASE : state; });
+			break;
+	}
+}
+
+void PacmanGame::setPlayerInput(std::size_t player, Direction direction) {
+	entityData(pacmen[player]).inputDirection = direction;
+}
+
+void PacmanGame::setAutopilot(std::size_t player, bool enabled) {
+	entityData(pacmen[player]).autopilot = enabled;
+}
+
+// releases the ghosts
+void PacmanGame::startGame() {
+	if (gameStarted) return;
+	uint64_t delay = 0;
+	for (std::size_t i = 0; i < packedData.size(); ++i) {
+		if (!packedData[i].isAI) continue;
+		events.schedule(delay, {GameEvent::RELEASE_GHOST, lifeGeneration, packedEntities[i]});
+		delay += gameSettings.ghostReleaseInterval;
+	}
+	gameStarted = true;
+}
+
+// marks the cells of the chasing ghosts and their neighbours. Done at most once per tick
+void PacmanGame::updateDangerMap() {
+	if (dangerTick == tickCount) return;
+	dangerTick = tickCount;
+
+	for (PacmanEntityData &data : packedData) {
+		if (!data.isAI || data.aiState != CHASE) continue;
+		glm::ivec2 position = worldToMap(data.position);
+		for (int dir = UP; dir <= NONE; ++dir) {
+			glm::ivec2 cell = position + getMapVector(Direction(dir));
+			if (isFree(cell)) get(dangerMap, cell) = tickCount;
+		}
+	}
+}
+
+// nothing is dangerous in god mode. Avoiding the ghosts anyway gets the autopilot stuck once they surround it
+bool PacmanGame::isDangerous(glm::ivec2 position) {
+	return !gameSettings.godMode && get(dangerMap, position) == tickCount;
+}
+
+// numbers the connected areas of free cells with a flood fill from every cell that has no area yet
+void PacmanGame::fillAreaMap() {
+	int areas = 0;
+	for (std::size_t y = 0; y < height; ++y) {
+		for (std::size_t x = 0; x < width; ++x) {
+			if (!isFree(x, y) || areaMap[y][x] != -1) continue;
+
+			// the queue lives in the preallocated bfsQueue, like in fillDistanceMapImpl()
+			std::size_t front = 0, back = 0;
+			areaMap[y][x]	  = areas;
+			bfsQueue[back++]  = glm::ivec2(x, y);
+			while (front != back) {
+				glm::ivec2 pos = bfsQueue[front++];
+				for (int dir = UP; dir < NONE; ++dir) {
+					glm::ivec2 neighbour = pos + getMapVector(Direction(dir));
+					if (!isFree(neighbour) || get(areaMap, neighbour) != -1) continue;
+					get(areaMap, neighbour) = areas;
+					bfsQueue[back++]		= neighbour;
+				}
 			}
-		});
+			++areas;
+		}
 	}
 }
 
-void PacmanGame::doWork() {
+// A* from start to target through free and safe cells.
+// returns the first step of the path or NONE if there is no path within the search limit
+PacmanGame::Direction PacmanGame::findPath(glm::ivec2 start, glm::ivec2 target) {
+	++currentSearch;
+	auto heuristic = [target](glm::ivec2 p) { return std::abs(p.x - target.x) + std::abs(p.y - target.y); };
+
+	searchQueue.clear();
+	get(searchStamp, start)		= currentSearch;
+	get(searchCost, start)		= 0;
+	get(searchFirstStep, start) = NONE;
+	searchQueue.push_back({heuristic(start), start});
+
+	unsigned int visited = 0;
+	while (!searchQueue.empty() && visited++ < gameSettings.autopilotSearchLimit) {
+		std::pop_heap(searchQueue.begin(), searchQueue.end(), std::greater<SearchNode>());
+		SearchNode node = searchQueue.back();
+		searchQueue.pop_back();
+
+		if (node.position == target) return Direction(get(searchFirstStep, target));
+		int cost = get(searchCost, node.position);
+		if (node.priority > cost + heuristic(node.position)) continue;	   // outdated entry
+
+		for (int dir = UP; dir < NONE; ++dir) {
+			glm::ivec2 neighbour = node.position + getMapVector(Direction(dir));
+			if (!isFree(neighbour) || isDangerous(neighbour)) continue;
+			if (get(searchStamp, neighbour) == currentSearch && get(searchCost, neighbour) <= cost + 1) continue;
+
+			get(searchStamp, neighbour)		= currentSearch;
+			get(searchCost, neighbour)		= cost + 1;
+			get(searchFirstStep, neighbour) = node.position == start ? dir : get(searchFirstStep, node.position);
+			searchQueue.push_back({cost + 1 + heuristic(neighbour), neighbour});
+			std::push_heap(searchQueue.begin(), searchQueue.end(), std::greater<SearchNode>());
+		}
+	}
+	return NONE;
+}
+
+bool PacmanGame::isDot(glm::ivec2 position) {
+	char c = get(map, position);
+	return c == '.' || c == '@';
+}
+
+// a simple scripted player: walks to the nearest dot and keeps away from chasing ghosts
+void PacmanGame::autopilot(std::size_t player, PacmanEntityData &data) {
+	glm::ivec2 position = playerPositions[player];
+	// stick to a target until it is eaten, otherwise the player may keep turning around between two of them.
+	// dots that the walls cut off are never picked, no search could reach them
+	glm::ivec2 &target = data.autopilotTarget;
+	if (target.x == -1 || !isDot(target)) target = dots.nearest(position, areaMap);
+	if (target.x == -1) return;
+
+	updateDangerMap();
+	Direction direction = findPath(position, target);
+
+	// the way is blocked by a ghost or too long for the search limit, step anywhere safe.
+	// the target is picked again at the next decision, from where pacman is then
+	if (direction == NONE) {
+		target = glm::ivec2(-1);
+		for (int dir = UP; dir < NONE; ++dir) {
+			glm::ivec2 neighbour = position + getMapVector(Direction(dir));
+			if (isFree(neighbour) && !isDangerous(neighbour)) {
+				direction = Direction(dir);
+				break;
+			}
+		}
+	}
+	if (direction != NONE) data.inputDirection = direction;
+}
+
+// applies the requests left by the key callback
+void PacmanGame::processInput() {
+	if (startRequested.exchange(false)) startGame();
+	InputEvent event;
+	while (inputEvents.pop(event)) applyTurn(event);
+	int ghostState = requestedGhostState.exchange(-1);
+	if (ghostState != -1) setGhostsState(State(ghostState));
+}
+
+// a turn from the keyboard, for the first pacman. Like any input, it waits until pacman reaches a cell where
+// it can turn, unless it was meant for the crossing that pacman has just passed
+void PacmanGame::applyTurn(const InputEvent &event) {
+	PacmanEntityData &data = entityData(pacmen[0]);
+	if (data.moveDirection != event.direction) {
+		pendingInput = event;
+		++inputCount;
+	}
+
+	if (!tryLateTurn(0, data, event)) setPlayerInput(0, event.direction);
+}
+
+bool PacmanGame::queueTurn(Direction direction, std::chrono::steady_clock::time_point time) {
+	return inputEvents.push({direction, time});
+}
+
+// what the player sees lags behind the simulation, so a key can be pressed for a crossing that pacman has
+// already left. If that was at most turnGraceTime ago, pacman is moved back to the crossing and on in the new
+// direction, as if the turn had arrived in time. Only movement is undone: if entering the next cell ate
+// something, the turn is too late
+bool PacmanGame::tryLateTurn(std::size_t player, PacmanEntityData &data, const InputEvent &event) {
+	using namespace std::chrono;
+	auto grace = milliseconds(gameSettings.turnGraceTime);
+	if (data.moveDirection == NONE || tickTime - event.time > grace) return false;
+	if (std::abs(event.direction - data.moveDirection) % 2 == 0) return false;	   // only turns
+
+	// the movement of the last tick may have entered a cell that updatePlayer() has not seen yet.
+	// then nothing has happened in that cell so far
+	glm::ivec2 cell		 = worldToMap(data.position);
+	bool	   committed = cell == playerPositions[player];
+	CellEntry  entry	 = playerCellEntries[player];
+	if (!committed) entry = {playerPositions[player], previousTickTime, false};
+
+	// pacman must have come straight from the crossing, still be before the center of the next cell
+	// and have left the crossing at most turnGraceTime before the key press
+	if (entry.previousCell != cell - getMapVector(data.moveDirection) || entry.ate) return false;
+	if (glm::dot(data.position - mapToWorld(cell), getWorldVector(data.moveDirection)) > 0) return false;
+	if (event.time - entry.time > grace) return false;
+	if (!isFree(entry.previousCell, event.direction)) return false;
+
+	// it would have gone in the new direction ever since the crossing, or since the key press if that was later
+	glm::vec2 crossing = mapToWorld(entry.previousCell);
+	float	  age	   = duration<float>(tickTime - event.time).count();
+	float	  distance = std::min(glm::distance(data.position, crossing), data.speed * std::max(age, 0.f));
+	data.position	   = crossing + getWorldVector(event.direction) * distance;
+	data.moveDirection = data.inputDirection = event.direction;
+
+	// pacman is back in the crossing as far as the game is concerned. There is no earlier entry to go back to,
+	// and the cell it came from must not allow another late turn
+	if (committed) {
+		playerPositions[player]	  = entry.previousCell;
+		playerCellEntries[player] = {entry.previousCell, entry.time, false};
+		fillDistanceMap(distanceMap, nearestPlayerMap, playerPositions);
+	}
+	return true;
+}
+
+// the turn that is waiting to be taken counts as applied once pacman moves that way
+void PacmanGame::updateInputLatency() {
+	if (pendingInput.direction == NONE || entityData(pacmen[0]).moveDirection != pendingInput.direction) return;
+
+	auto now	 = std::chrono::steady_clock::now();
+	appliedInput = {inputCount, pendingInput.time, now};
+	metrics.inputToState.record(std::chrono::duration<double, std::milli>(now - pendingInput.time).count());
+	pendingInput.direction = NONE;
+}
+
+void PacmanGame::tick(float deltaTime) {
+	previousTickTime = tickTime;
+	tickTime		 = std::chrono::steady_clock::now();
+	for (PacmanEntityData &data : packedData) data.previousPosition = data.position;
+	processInput();
+	++tickCount;
 	if (gameEnded) return;
+	GameMetrics::add(metrics.ticks);
+
+	// nobody has to press a key if the pacmen play by themselves
+	if (gameSettings.autopilot) startGame();
+
+	// fire the effects that are due
+	simulationTime += deltaTime * 1000.;
+	events.advance(simulationTime, [this](const GameEvent &event) { fireEvent(event); });
+
+	// update players
+	bool playersMoved = false;
+	for (std::size_t i = 0; i < pacmen.size(); ++i) {
+		PacmanEntityData &pacmanData = entityData(pacmen[i]);
+		bool			  moved		 = updatePlayer(i, pacmanData);
+		playersMoved |= moved;
+		// the autopilot decides only when entering a new cell or when stuck
+		if ((pacmanData.autopilot || gameSettings.autopilot) && (moved || pacmanData.moveDirection == NONE)) {
+			autopilot(i, pacmanData);
+		}
+		updatePacmanEntity(pacmanData, deltaTime);
+	}
 
-	ygl::Transformation &pacmanTransform = scene->getComponent<ygl::Transformation>(pacman);
-	PacmanEntityData	&pacmanData		 = scene->getComponent<PacmanEntityData>(pacman);
+	updateInputLatency();
 
-	// update player and pill
-	checkPillTimer();
-	updatePlayer(pacmanTransform, pacmanData);
-	updatePacmanEntity(pacmanData, pacmanTransform);
+	// recalculate ghosts pathfinding, once for all players
+	if (playersMoved) fillDistanceMap(distanceMap, nearestPlayerMap, playerPositions);
 
 	// iterate through ghosts
-	for (ygl::Entity e : this->entities) {
-		if (e == pacman) continue;
-		PacmanEntityData	&data	   = scene->getComponent<PacmanEntityData>(e);
-		ygl::Transformation &transform = scene->getComponent<ygl::Transformation>(e);
+	// a linear scan over the packed arrays, starting where the AI budget ran out in the last tick
+	aiLevelCounts.fill(0);
+	auto		loopStart  = std::chrono::steady_clock::now();
+	auto		budget	   = std::chrono::microseconds(gameSettings.aiBudget);
+	bool		overBudget = false;
+	std::size_t count	   = packedData.size();
+	std::size_t first	   = count ? aiCursor % count : 0;
+	for (std::size_t k = 0; k < count; ++k) {
+		std::size_t		  i	   = first + k < count ? first + k : first + k - count;
+		PacmanEntityData &data = packedData[i];
+		if (!data.isAI) continue;	  // players are already updated
+
+		AILevel level = ghostAILevel(i, data, deltaTime, overBudget);
+		++aiLevelCounts[level];
+		if (level == AI_IDLE || level == AI_DEFERRED) {
+			// moves later, in one longer step
+			data.pendingTime += deltaTime;
+		} else {
+			data.lastThinkTick = tickCount;
+			ghostAI(packedEntities[i], data);
+
+			// a catch needs less than a cell of distance, so only the pacmen in the cells around the ghost can make it.
+			// nearestPlayerMap is not enough: it names one of two pacmen at the same distance from the ghost's cell
+			glm::ivec2 cell = worldToMap(data.position);
+			for (ygl::Entity pacman : pacmen) {
+				PacmanEntityData &pacmanData = entityData(pacman);
+				glm::ivec2		  offset	 = worldToMap(pacmanData.position) - cell;
+				if (std::abs(offset.x) <= 1 && std::abs(offset.y) <= 1) checkCollision(data, pacmanData);
+			}
+			checkHomeReached(data);
+
+			updatePacmanEntity(data, deltaTime + data.pendingTime);
+			data.pendingTime = 0;
+		}
+
+		// reading the clock costs about as much as a ghost, so it is done every few of them
+		if (budget.count() && !overBudget && k % 64 == 63 && std::chrono::steady_clock::now() - loopStart > budget) {
+			overBudget = true;
+			aiCursor   = i + 1;
+		}
+	}
+	// every ghost has had its turn, the next tick starts from the beginning again
+	if (!overBudget) aiCursor = 0;
+	for (std::size_t level = 0; level < AI_LEVELS_COUNT; ++level) {
+		GameMetrics::add(metrics.ghostUpdates[level], aiLevelCounts[level]);
+	}
+}
+
+static_assert(GameMetrics::aiLevelsCount == PacmanGame::AI_LEVELS_COUNT);
+
+// ghosts near a pacman think and move every tick. The others think and move every aiReducedInterval ticks,
+// staggered so that they do not all do it in the same tick, and only while there is AI budget left.
+// ghosts going home always run, they have to notice that they have arrived
+PacmanGame::AILevel PacmanGame::ghostAILevel(std::size_t index, const PacmanEntityData &data, float deltaTime,
+											 bool overBudget) {
+	if (!gameSettings.aiLevelOfDetail || data.aiState == GO_HOME) return AI_FULL;
+
+	int distance = get(distanceMap, worldToMap(data.position));
+	if (distance != -1 && distance <= int(gameSettings.aiNearDistance)) return AI_FULL;
+
+	// the collision checks of updatePacmanEntity() need steps shorter than half a cell, budget or not
+	const float maxStep = 0.45f;
+	if ((data.pendingTime + deltaTime) * data.speed > maxStep) return AI_REDUCED;
+
+	uint64_t interval = std::max(gameSettings.aiReducedInterval, 1u);
+	bool	 due	  = (index + tickCount) % interval == 0 || tickCount - data.lastThinkTick > interval;
+	if (!due) return AI_IDLE;
+	return overBudget ? AI_DEFERRED : AI_REDUCED;
+}
+
+// copies the simulation state into the triple buffer for the render thread.
+// time is when the tick was due, so that the render thread does not see how late it woke up
+void PacmanGame::publishSnapshot(std::chrono::steady_clock::time_point time) {
+	PacmanSnapshot &snapshot = snapshots.writeBuffer();
+	snapshot.tick			 = tickCount;
+	snapshot.time			 = time;
+	snapshot.score			 = score;
+	snapshot.lives			 = lives;
+	snapshot.gameStarted	 = gameStarted;
+	snapshot.gameEnded		 = gameEnded;
+	snapshot.gameFinishedWin = gameFinishedWin;
+	snapshot.lastInput		 = appliedInput;
+
+	snapshot.entities.clear();
+	for (std::size_t i = 0; i < packedData.size(); ++i) {
+		const PacmanEntityData &data = packedData[i];
+		snapshot.entities.push_back(
+			{packedEntities[i], data.position, data.previousPosition, data.rotation, data.matIdx});
+	}
+	snapshots.publish();
+}
+
+// ticks the game at a fixed rate until stopSimulation() is called
+void PacmanGame::simulationLoop() {
+	using clock				   = std::chrono::steady_clock;
+	const auto tickDuration	   = std::chrono::nanoseconds(1'000'000'000 / gameSettings.tickRate);
+	const auto maxLag		   = tickDuration * 5;
+	const float deltaTime	   = 1.f / gameSettings.tickRate;
+	auto	   nextTick		   = clock::now();
+
+	while (simulationRunning.load(std::memory_order_relaxed)) {
+		tick(deltaTime);
+		publishSnapshot(nextTick);
+
+		nextTick += tickDuration;
+		// if we fall too far behind, give up on catching up instead of spiralling
+		auto now = clock::now();
+		if (nextTick + maxLag < now) nextTick = now;
+		std::this_thread::sleep_until(nextTick);
+	}
+}
+
+void PacmanGame::startSimulation() {
+	if (simulationRunning) return;
+	simulationRunning = true;
+	simulationThread  = std::thread(&PacmanGame::simulationLoop, this);
+}
+
+void PacmanGame::stopSimulation() {
+	simulationRunning = false;
+	if (simulationThread.joinable()) simulationThread.join();
+}
+
+// erases the eaten dots from the map texture. Must be called on the thread with the GL context
+void PacmanGame::applyDotUpdates() {
+	{
+		std::lock_guard lock(dotUpdatesMutex);
+		if (dotUpdates.empty()) return;
+		std::swap(appliedDotUpdates, dotUpdates);
+	}
+
+	mapTexture->bind(GL_TEXTURE1);
+	uchar data[] = {0, 0, 0, 255};
+	glActiveTexture(GL_TEXTURE1);
+	for (glm::ivec2 position : appliedDotUpdates) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, position.x, height - position.y - 1, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	mapTexture->unbind(GL_TEXTURE1);
+	appliedDotUpdates.clear();
+}
 
-		if (data.isAI) {	 // redundant check, but leave it here for future extendability
-			ghostAI(e, transform, data);
+// render thread side of the game. Picks up new snapshots and writes the state interpolated between
+// the latest tick and the one before it into the transforms and materials of the entities
+void PacmanGame::doWork() {
+	if (headless) return;
 
-			checkCollision(e, transform, data, pacmanTransform, pacmanData);
+	// doWork() runs once per frame, so the time between two calls is the frame time
+	auto now = std::chrono::steady_clock::now();
+	if (lastFrameTime.time_since_epoch().count() != 0) {
+		metrics.frameTimes.record(std::chrono::duration<double, std::milli>(now - lastFrameTime).count());
+	}
+	lastFrameTime = now;
+
+	if (snapshots.update()) currentSnapshot = snapshots.readBuffer();
+	applyDotUpdates();
+
+	// the rendered time lags one tick behind, so that it always lies between the two states of the snapshot,
+	// no matter how many ticks ran since the last frame.
+	// in low latency mode the latest tick is shown as it is, which is a tick sooner but less smooth
+	float alpha = 1.f;
+	if (!gameSettings.lowLatency) {
+		std::chrono::duration<float> tickDuration(1.f / gameSettings.tickRate);
+		alpha = (now - currentSnapshot.time) / tickDuration;
+		alpha = glm::clamp(alpha, 0.f, 1.f);
+	}
+
+	for (std::size_t i = 0; i < currentSnapshot.entities.size(); ++i) {
+		const PacmanSnapshot::EntityState &current	= currentSnapshot.entities[i];
+		glm::vec2						   position = current.position;
+		// do not blend through teleports and respawns
+		if (alpha < 1.f && glm::distance(current.previousPosition, current.position) < 1.f) {
+			position = glm::mix(current.previousPosition, current.position, alpha);
 		}
 
-		updatePacmanEntity(data, transform);
+		ygl::Transformation &transform = scene->getComponent<ygl::Transformation>(current.entity);
+		transform.position.x		   = position.x;
+		transform.position.y		   = position.y;
+		transform.rotation.z		   = current.rotation;
+		transform.updateWorldMatrix();
+
+		scene->getComponent<ygl::RendererComponent>(current.entity).materialIndex = current.matIdx;
+	}
+}
+
+// the time right after swapping is as close to the time of presenting as the render thread can tell.
+// with vsync the frame may still wait for the display, unless the caller waits for the GPU to finish
+void PacmanGame::framePresented() {
+	if (headless) return;
+	++frameCount;
+	const PacmanSnapshot::AppliedInput &input = currentSnapshot.lastInput;
+	if (input.id == presentedInputId) return;
+	presentedInputId = input.id;
+
+	auto   millis	 = [](auto duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+	double toState	 = millis(input.stateTime - input.pressTime);
+	double toPresent = millis(std::chrono::steady_clock::now() - input.pressTime);
+	metrics.inputToPresent.record(toPresent);
+	if (gameSettings.reportInputLatency) {
+		dbLog(ygl::LOG_INFO, "frame ", frameCount, ": input-to-state ", toState, "ms, input-to-present ", toPresent,
+			  "ms");
 	}
 }
 
-// resets the game when the player dies
+void PacmanGame::rasterize(SoftwareRasterizer &rasterizer, uint8_t *pixels, bool reference) {
+	sprites.clear();
+	// pacmen first, because the ghosts are drawn on top of them
+	for (ygl::Entity pacman : pacmen) {
+		PacmanEntityData &pacmanData = entityData(pacman);
+		sprites.push_back({SoftwareRasterizer::PACMAN, pacmanData.position, pacmanData.rotation, pacmanData.color});
+	}
+
+	for (PacmanEntityData &data : packedData) {
+		if (!data.isAI) continue;
+
+		SoftwareRasterizer::SpriteType type = SoftwareRasterizer::GHOST;
+		if (data.aiState == RUN) type = SoftwareRasterizer::WEAK_GHOST;
+		if (data.aiState == GO_HOME) type = SoftwareRasterizer::DEAD_GHOST;
+		sprites.push_back({type, data.position, data.rotation, data.color});
+	}
+
+	if (reference) rasterizer.renderReference(map, sprites, pixels);
+	else rasterizer.render(map, sprites, pixels);
+}
+
+// resets the game when a player dies
 void PacmanGame::restartAfterDeath() {
-	ygl::Transformation &pacmanTransform = scene->getComponent<ygl::Transformation>(pacman);
-	PacmanEntityData	&pacmanData		 = scene->getComponent<PacmanEntityData>(pacman);
-	glm::vec2			 playerPos		 = mapToWorld(pacmanStartPosition);
-	pacmanTransform.position.x			 = playerPos.x;
-	pacmanTransform.position.y			 = playerPos.y;
-	pacmanTransform.rotation.z			 = 0;
-	pacmanData.moveDirection			 = NONE;
-	pacmanData.inputDirection			 = NONE;
-
-	pacmanTransform.updateWorldMatrix();
-
-	for (ygl::Entity e : this->entities) {
-		ygl::Transformation &transform = scene->getComponent<ygl::Transformation>(e);
-		PacmanEntityData	&data	   = scene->getComponent<PacmanEntityData>(e);
-		if (data.isAI) {
-			glm::vec2 startPos	 = mapToWorld(data.startPosition);
-			transform.position.x = startPos.x;
-			transform.position.y = startPos.y;
-			transform.rotation.z = 0;
-			transform.updateWorldMatrix();
-
-			data.aiState		= State::STAY;
-			data.inputDirection = NONE;
-			data.moveDirection	= NONE;
-		}
+	++lifeGeneration;
+	for (PacmanEntityData &data : packedData) {
+		data.position		= mapToWorld(data.startPosition);
+		data.rotation		= 0;
+		data.inputDirection = NONE;
+		data.moveDirection	= NONE;
+		data.pendingTime	= 0;
+		setGhostState(data, [](State) { return STAY; });
 	}
 
 	gameStarted = false;
 }
 
 PacmanGame::~PacmanGame() {
-	deleteMap(map, width, height);
-	deleteMap(distanceMap, width, height);
-	deleteMap(homeDistanceMap, width, height);
+	stopSimulation();
+	deleteMap(map);
+	deleteMap(distanceMap);
+	deleteMap(nearestPlayerMap);
+	deleteMap(searchStamp);
+	deleteMap(searchCost);
+	deleteMap(searchFirstStep);
+	deleteMap(dangerMap);
+	deleteMap(areaMap);
+	deleteMap(homeDistanceMap);
 }
 
 void PacmanGame::write(std::ostream &){THROW_RUNTIME_ERR("SERIALIZING A PACMAN GAME IS NOT SUPPORTED")};
@@ -696,7 +1303,10 @@ void TextCentered(std::string text) {
 
 
 // the gui of the game. Yes, it's hardly readable
+// it runs on the render thread, so it shows the state from the latest snapshot
 void PacmanGame::drawGUI() {
+	const PacmanSnapshot &state = currentSnapshot;
+
 	ImGuiWindowFlags flags = ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove |
 							 ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoSavedSettings |
 							 ImGuiWindowFlags_NoInputs;
@@ -706,18 +1316,18 @@ void PacmanGame::drawGUI() {
 	ImGui::SetNextWindowPos(ImVec2(0, 0));
 	ImGui::SetNextWindowSize(ImVec2(window->getWidth() / 3.f, 50.f));
 	ImGui::Begin("score", nullptr, flags);
-	ImGui::Text("Score: %d", getScore());
+	ImGui::Text("Score: %d", state.score);
 	ImGui::End();
 
 	ImGui::SetNextWindowBgAlpha(0.0f);
 	ImGui::SetNextWindowPos(ImVec2(window->getWidth() * 2 / 3.f, 0.f));
 	ImGui::SetNextWindowSize(ImVec2(window->getWidth() / 3.f, 50.f));
 	ImGui::Begin("lives", nullptr, flags);
-	ImGui::Text("Lives: %d", getLives());
+	ImGui::Text("Lives: %d", state.lives);
 	ImGui::End();
 
-	if (hasGameEnded()) {
-		if (isGameWon()) {
+	if (state.gameEnded) {
+		if (state.gameFinishedWin) {
 			ImGui::SetNextWindowPos(ImVec2(window->getWidth() / 3., window->getHeight() / 2. - 25));
 			ImGui::SetNextWindowSize(ImVec2(window->getWidth() / 3., 50));
 			ImGui::Begin("You Won", nullptr, flags);
@@ -731,7 +1341,7 @@ void PacmanGame::drawGUI() {
 			ImGui::End();
 		}
 	}
-	if (!hasGameStarted()) {
+	if (!state.gameStarted) {
 		ImGui::SetNextWindowPos(ImVec2(window->getWidth() / 4., window->getHeight() / 3.));
 		ImGui::SetNextWindowSize(ImVec2(window->getWidth() / 2., window->getHeight() / 3.));
 		ImGui::Begin("BeforeStart", nullptr, flags);
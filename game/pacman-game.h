@@ -7,10 +7,30 @@
 #include <timer.h>
 #include <renderer.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <future>
 #include <cstring>
+#include <mutex>
+#include <random>
+#include <span>
 #include <string>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "triple-buffer.h"
+#include "spsc-ring.h"
+#include "software-rasterizer.h"
+#include "dot-index.h"
+#include "fixed-level.h"
+#include "timer-wheel.h"
+#include "asset-bundle.h"
+#include "metrics.h"
 
 #include <imgui.h>
 
@@ -22,11 +42,55 @@ struct PacmanGameSettings {
 	float		 weakGhostSpeed		  = 3.0f;
 	float		 deadGhostSpeed		  = 4.0f;
 	uint64_t	 pillEffectDuration	  = 5000;	  // time in ms
+	uint64_t	 ghostReleaseInterval = 0;		  // time in ms between leaving home of consecutive ghosts
 	unsigned int eatDotScore		  = 10;
 	unsigned int eatPillScore		  = 50;
 	unsigned int eatGhostScore		  = 100;
 	unsigned int pacmanLives		  = 3;
+	unsigned int tickRate			  = 120;	 // simulation ticks per second
 	bool		 godMode			  = false;
+	bool		 autopilot			  = false;	   // all pacmen play by themselves
+	unsigned int autopilotSearchLimit = 1 << 16;	 // max cells visited by one autopilot path search
+	bool		 fixedSizeFastPath	  = true;	   // use the BFS specialized for the classic level size
+
+	// level of detail for the ghost AI. Changes the behaviour of distant ghosts, so it is off by default
+	bool		 aiLevelOfDetail   = false;
+	unsigned int aiNearDistance	   = 16;	 // cells from the closest pacman within which ghosts think every tick
+	unsigned int aiReducedInterval = 8;		 // ticks between the decisions of the other ghosts
+	unsigned int aiBudget		   = 0;		 // microseconds per tick for the ghost loop, 0 for no limit
+
+	// keyboard input
+	unsigned int turnGraceTime		= 100;		// ms after leaving a crossing for which a turn pressed late still takes it
+	bool		 reportInputLatency = false;	// log the input latency of every frame that shows a new turn
+	bool		 lowLatency			= false;	// render the latest tick instead of blending towards it
+};
+
+// immutable copy of the simulation state that is handed from the simulation thread to the render thread
+struct PacmanSnapshot {
+	struct EntityState {
+		ygl::Entity	 entity;
+		glm::vec2	 position;
+		glm::vec2	 previousPosition;	   // at the end of the tick before, the render thread blends between the two
+		float		 rotation;
+		unsigned int matIdx;
+	};
+
+	uint64_t								 tick = 0;
+	std::chrono::steady_clock::time_point	 time;	   // when the tick was due, not when it ran
+	std::vector<EntityState>				 entities;
+	unsigned int							 score			 = 0;
+	unsigned int							 lives			 = 0;
+	bool									 gameStarted	 = false;
+	bool									 gameEnded		 = false;
+	bool									 gameFinishedWin = false;
+
+	// the last keyboard turn that the simulation has applied, for measuring input latency
+	struct AppliedInput {
+		uint64_t							  id = 0;
+		std::chrono::steady_clock::time_point pressTime;	 // when the key callback received it
+		std::chrono::steady_clock::time_point stateTime;	 // in the tick in which pacman turned
+	};
+	AppliedInput lastInput;
 };
 
 class PacmanGame : public ygl::ISystem {
@@ -34,50 +98,112 @@ class PacmanGame : public ygl::ISystem {
 	enum Direction { UP = 0, LEFT = 1, DOWN = 2, RIGHT = 3, NONE = 4 };
 
 	enum State { STAY, CHASE, RUN, GO_HOME };
-	class PacmanEntityData : public ygl::Serializable {
+
+	// how much of the AI a ghost ran in a tick. Distant ghosts are idle between their decisions,
+	// and deferred when they are due but the AI budget has run out
+	enum AILevel { AI_FULL, AI_REDUCED, AI_IDLE, AI_DEFERRED, AI_LEVELS_COUNT };
+	// marks the entities of this system in the scene. Their state is not a component, it is in the packed arrays
+	class PacmanEntity : public ygl::Serializable {
 	   public:
 		static const char *name;
+
+		void serialize(std::ostream &out) { THROW_RUNTIME_ERR("SERIALIZING A PACMAN GAME IS NOT SUPPORTED") }
+		void deserialize(std::istream &in) { THROW_RUNTIME_ERR("SERIALIZING A PACMAN GAME IS NOT SUPPORTED") }
+	};
+
+	class PacmanEntityData {
+	   public:
 		Direction		   inputDirection;
 		Direction		   moveDirection;
 		bool			   isAI;
 		float			   speed;
 		State			   aiState;
 		unsigned int	   originalMatIdx;
+		unsigned int	   matIdx;	   // material to render with, applied by the render thread
 		glm::ivec2		   startPosition;
+		glm::vec2		   position;	 // world position, owned by the simulation thread
+		glm::vec2		   previousPosition;	// position at the end of the previous tick
+		float			   rotation;
+		unsigned int	   color;		 // index of the ghost body color in getGhostColors()
+		bool			   autopilot;	 // pacman that plays by itself
+		glm::ivec2		   autopilotTarget;	    // dot that the autopilot is going for
+		uint64_t		   lastThinkTick;		// last tick in which the ghost AI ran
+		float			   pendingTime;			// time that an idle ghost has not moved for yet
 
 		PacmanEntityData(bool isAI, float speed)
-			: inputDirection(NONE), moveDirection(NONE), isAI(isAI), speed(speed), aiState(STAY), originalMatIdx(-1), startPosition(0) {}
-		PacmanEntityData() : PacmanEntityData(true, 7.0) {}		// obligatory default constructor because of engine
-
-		void serialize(std::ostream &out) { THROW_RUNTIME_ERR("SERIALIZING A PACMAN GAME IS NOT SUPPORTED") }
-		void deserialize(std::istream &in) { THROW_RUNTIME_ERR("SERIALIZING A PACMAN GAME IS NOT SUPPORTED") }
+			: inputDirection(NONE),
+			  moveDirection(NONE),
+			  isAI(isAI),
+			  speed(speed),
+			  aiState(STAY),
+			  originalMatIdx(-1),
+			  matIdx(-1),
+			  startPosition(0),
+			  position(0),
+			  previousPosition(0),
+			  rotation(0),
+			  color(0),
+			  autopilot(false),
+			  autopilotTarget(-1),
+			  lastThinkTick(0),
+			  pendingTime(0) {}
 	};
 
 	PacmanGameSettings gameSettings; // customizable game settings
 
    private:
 	std::size_t width, height; // dimensions
+	bool		headless;	   // no window, renderer or GPU resources
 	
 	// map, read from file
 	char		  **map;
 	// distance fields for path finding
-	int			  **distanceMap;
+	int			  **distanceMap;		 // distance to the closest pacman
+	int			  **nearestPlayerMap;	 // index in pacmen of the closest pacman, -1 if unreachable
 	int			  **homeDistanceMap;
-	ygl::Texture2d *mapTexture;
+	// queue for the BFS. Every cell enters it at most once, so it never has to grow
+	std::vector<glm::ivec2> bfsQueue;
+	// BFS specialized for the dimensions of the classic level, null for other sizes
+	std::unique_ptr<FixedFlowField<classicWidth, classicHeight>> classicFlowField;
+	// remaining dots, for the autopilot
+	DotIndex		dots;
+	bool			isDot(glm::ivec2 position);
+	ygl::Texture2d *mapTexture = nullptr;
 	// indexes for reference in Renderer and AssetManager
 	unsigned int	quadMeshIndex;
 	unsigned int	deadMatIdx;
 	unsigned int	weakMatIdx;
+	unsigned int	ghostMatIdx[4];
+	unsigned int	ghostShaderIndex;
+	std::size_t		ghostCount = 0;
 
-	// unique entities that must be remembered
-	ygl::Entity		mapQuad = -1;
-	ygl::Entity		pacman	= -1;
+	// packed simulation state of the entities in this system, so that the update loops are linear scans.
+	// packedIndex maps an entity to its position in the packed arrays
+	static constexpr uint32_t	  noIndex = -1;
+	std::vector<ygl::Entity>	  packedEntities;
+	std::vector<PacmanEntityData> packedData;
+	std::vector<uint32_t>		  packedIndex;
 
-	glm::ivec2	 lastPlayerPosition; // used for controlled computation of path finding
+	// the returned reference is invalidated by the next addEntityData() or removeGhost()
+	PacmanEntityData &addEntityData(ygl::Entity e, const PacmanEntityData &data);
+	PacmanEntityData &entityData(ygl::Entity e);
+
+	// unique entities that must be remembered
+	ygl::Entity				 mapQuad = -1;
+	std::vector<ygl::Entity> pacmen;	 // the first one is controlled by the keyboard
+
+	std::vector<glm::ivec2> playerPositions;	 // map positions of the pacmen, used for controlled computation of path finding
+	// the cell that each pacman came from and when it entered its current one, for turns that arrive late
+	struct CellEntry {
+		glm::ivec2							  previousCell;
+		std::chrono::steady_clock::time_point time;	    // start of the tick that moved pacman into the cell
+		bool								  ate;		// entering the cell ate a dot or a pill
+	};
+	std::vector<CellEntry> playerCellEntries;
 
 	// these are read from the map
-	glm::ivec2	 pacmanStartPosition;
-	glm::ivec2	 homePosition;
+	std::vector<glm::ivec2> pacmanStartPositions;
+	glm::ivec2				homePosition;
 
 	// window pointer
 	ygl::Window *window;
@@ -91,25 +217,104 @@ class PacmanGame : public ygl::ISystem {
 	unsigned int lives;
 
 	// font for the GUI
-	ImFont		*font;
+	ImFont		*font = nullptr;
+
+	// startup assets, read or decoded on a worker thread while the map is being set up
+	std::future<AssetBundle>			  assetsLoading;
+	AssetBundle							  assets;
+	std::chrono::steady_clock::time_point constructionTime;
+	double								  startupTime = 0;	   // ms from the constructor to the end of init()
 
-	// counts time from consuming a pill
-	Timer pillTimer;
+	GameMetrics							  metrics;
+	std::chrono::steady_clock::time_point lastFrameTime;
 
+	ygl::Texture2d *createTexture(const std::string &file);
+
+	// scheduled game effects, keyed on simulation time in ms
+	struct GameEvent {
+		enum Type { PILL_EXPIRED, RELEASE_GHOST };
+		Type		 type;
+		unsigned int generation;	 // events from an outdated generation are ignored
+		ygl::Entity	 entity;
+	};
+	TimerWheel<GameEvent> events;
+	double				  simulationTime = 0;	  // in ms
+	// wall clock at the start of the current and the previous tick, for comparing with key presses
+	std::chrono::steady_clock::time_point tickTime, previousTickTime;
+	unsigned int		  pillGeneration = 0;	  // a new pill postpones the end of the previous one
+	unsigned int		  lifeGeneration = 0;	  // dying cancels the ghost releases
+
+	// simulation thread and its communication with the render thread
+	std::thread				   simulationThread;
+	std::atomic<bool>		   simulationRunning = false;
+	uint64_t				   tickCount		 = 0;
+	TripleBuffer<PacmanSnapshot> snapshots;
+	PacmanSnapshot			   currentSnapshot;	    // the latest snapshot, owned by the render thread
+
+	// input from the key callback, consumed by the simulation on the next tick.
+	// turns are timestamped and queued, so that none is lost and a late one can still be taken where it was meant
+	struct InputEvent {
+		Direction							  direction;
+		std::chrono::steady_clock::time_point time;
+	};
+	SpscRing<InputEvent, 64> inputEvents;
+	std::atomic<int>		 requestedGhostState = -1;
+	std::atomic<bool>		 startRequested		 = false;
+
+	// input latency: the turn that pacman has not taken yet, and the last one that it has
+	uint64_t					 inputCount	  = 0;
+	InputEvent					 pendingInput = {NONE, {}};
+	PacmanSnapshot::AppliedInput appliedInput;
+	// render thread side
+	uint64_t presentedInputId = 0;
+	uint64_t frameCount		  = 0;
+
+	// eaten dots that are not yet erased from the map texture
+	std::mutex				dotUpdatesMutex;
+	std::vector<glm::ivec2> dotUpdates;
+	std::vector<glm::ivec2> appliedDotUpdates;	   // swapped with dotUpdates to keep both allocations
+
+	// reused by rasterize() to avoid allocating every frame
+	std::vector<SoftwareRasterizer::Sprite> sprites;
+
+	// autopilot path search buffers. A cell is valid only if its stamp matches the current search,
+	// so they never have to be cleared
+	struct SearchNode {
+		int		   priority;
+		glm::ivec2 position;
+		bool	   operator>(const SearchNode &other) const { return priority > other.priority; }
+	};
+	unsigned int		  **searchStamp;
+	int					  **searchCost;
+	char				  **searchFirstStep;
+	// areas of free cells that are connected the way findPath() moves. The walls never change, so it is filled once.
+	// a dot in another area than the pacman can never be reached
+	int					  **areaMap;
+	unsigned int			currentSearch = 0;
+	std::vector<SearchNode> searchQueue;
+	// cells next to chasing ghosts
+	uint64_t	  **dangerMap;
+	uint64_t		dangerTick = 0;
+
+	void create(std::istream &in);
 	void createMap(ygl::Renderer *renderer, ygl::AssetManager *asman);
-	void createPacman(ygl::Renderer *renderer, ygl::AssetManager *asman);
+	void createPacmen(ygl::Renderer *renderer, ygl::AssetManager *asman);
 	void createGhosts(ygl::Renderer *renderer, ygl::AssetManager *asman);
-	void setGhostState(ygl::Entity e, PacmanEntityData &data, std::function<State(State)> f);
-	void setGhostsState(std::function<State(State)> f);
+	// f maps the old state to the new one. Templates instead of std::function, so that nothing is allocated
+	template <class F>
+	void setGhostState(PacmanEntityData &data, F f);
+	template <class F>
+	void setGhostsState(F f);
 	void setGhostsState(State state);
 
 	float generateGhostSpeed();
+	// every game has its own random numbers, so that games running side by side do not affect each other
+	std::minstd_rand rng;
 
 	glm::ivec2 worldToMap(glm::vec2 position);
 	glm::vec2  mapToWorld(glm::ivec2 position);
 	bool	   isFree(unsigned int x, unsigned int y, bool onFail);
 	bool	   isFree(unsigned int x, unsigned int y);
-	bool	   isFree(glm::ivec2 pos);
 	bool	   isFree(glm::ivec2 pos, Direction direction, bool onFail);
 	bool	   isFree(glm::ivec2 pos, Direction direction);
 
@@ -117,32 +322,71 @@ class PacmanGame : public ygl::ISystem {
 	bool tryDirection(Direction inputDirection, Direction &moveDirection, glm::ivec2 posOnMap);
 	void printDistanceMap(int **distanceMap);
 
-	void updatePacmanEntity(PacmanEntityData &data, ygl::Transformation &transform);
+	void updatePacmanEntity(PacmanEntityData &data, float deltaTime);
 	void go_to_target(int **distanceMap, Direction dir, glm::ivec2 position, PacmanEntityData &data, int dist);
 	void run_from_target(int **distanceMap, Direction dir, glm::ivec2 position, PacmanEntityData &data, int dist);
 	void resolveAIState(int **map, glm::ivec2 position, unsigned char start, PacmanEntityData &data,
-						std::function<void(int **, Direction, glm::ivec2, PacmanEntityData &, int)> tryDirection);
-	void ghostAI(ygl::Entity e, ygl::Transformation &transform, PacmanEntityData &data);
+						void (*tryDirection)(int **, Direction, glm::ivec2, PacmanEntityData &, int));
+	void ghostAI(ygl::Entity e, PacmanEntityData &data);
+
+	// level of detail scheduling
+	std::array<std::size_t, AI_LEVELS_COUNT> aiLevelCounts{};	  // of the last tick
+	std::size_t								 aiCursor = 0;		  // the ghost loop starts here, so that deferred ghosts go first
+
+	AILevel ghostAILevel(std::size_t index, const PacmanEntityData &data, float deltaTime, bool overBudget);
+
 	void fillDistanceMap(int **distanceMap, glm::ivec2 start);
+	void fillDistanceMap(int **distanceMap, int **nearestMap, std::span<const glm::ivec2> starts);
+	void fillDistanceMapImpl(int **distanceMap, int **nearestMap, std::span<const glm::ivec2> starts);
 	void eatDot(glm::ivec2 position);
 
-	void updatePlayer(ygl::Transformation &transform, PacmanEntityData &data);
-	void checkCollision(ygl::Entity ghost, ygl::Transformation &ghostTransform, PacmanEntityData &ghostData,
-						ygl::Transformation &pacmanTransform, PacmanEntityData &pacmanData);
-	void checkPillTimer();
+	bool updatePlayer(std::size_t player, PacmanEntityData &data);
+	void checkCollision(PacmanEntityData &ghostData, PacmanEntityData &pacmanData);
+	void checkHomeReached(PacmanEntityData &ghostData);
+	void fireEvent(const GameEvent &event);
 	void restartAfterDeath();
 
+	void updateDangerMap();
+	bool isDangerous(glm::ivec2 position);
+	void	  fillAreaMap();
+	Direction findPath(glm::ivec2 start, glm::ivec2 target);
+	void autopilot(std::size_t player, PacmanEntityData &data);
+
+	void processInput();
+	void applyTurn(const InputEvent &event);
+	bool tryLateTurn(std::size_t player, PacmanEntityData &data, const InputEvent &event);
+	void updateInputLatency();
+	void publishSnapshot(std::chrono::steady_clock::time_point time);
+	void simulationLoop();
+	void applyDotUpdates();
+
    public:
 	static glm::ivec2 getMapVector(Direction dir);
 	static glm::vec2  getWorldVector(Direction dir);
+	// body colors of the ghosts, they take turns. A SoftwareRasterizer for the game needs them
+	static std::span<const glm::vec3> getGhostColors();
 
 	static const char *name;
 
-	PacmanGame(ygl::Scene *scene, const std::string &map_file, std::size_t width, std::size_t height);
+	// a headless game only simulates and can be drawn with rasterize(). It does not need a window or a GL context
+	PacmanGame(ygl::Scene *scene, const std::string &map_file, std::size_t width, std::size_t height,
+			   bool headless = false);
+	// reads the map from a stream instead of a file, e.g. a std::istringstream with a generated level
+	PacmanGame(ygl::Scene *scene, std::istream &level, std::size_t width, std::size_t height, bool headless = false);
 
 	void init() override;
 
+	// advances the simulation by one step. Does not touch any GPU or renderer state
+	void tick(float deltaTime);
+
+	// runs tick() on a separate thread at gameSettings.tickRate
+	void startSimulation();
+	void stopSimulation();
+
+	// render thread: interpolates the latest snapshot into the scene transforms
 	void doWork() override;
+	// render thread: call it right after the frame is swapped. Measures the latency of the turns that it shows
+	void framePresented();
 
 	~PacmanGame() override;
 
@@ -153,9 +397,40 @@ class PacmanGame : public ygl::ISystem {
 	unsigned int getLives() { return lives; }
 	std::size_t	 getWidth() { return width; }
 	std::size_t	 getHeight() { return height; }
+	std::size_t	 getPlayerCount() { return pacmen.size(); }
+	double		 getStartupTime() { return startupTime; }
+	// number of ghosts at each AILevel in the last tick
+	const std::array<std::size_t, AI_LEVELS_COUNT> &getAILevelCounts() { return aiLevelCounts; }
+	GameMetrics &getMetrics() { return metrics; }
+
+	bool isFree(glm::ivec2 pos);
+
+	// adds and removes ghosts. Call them before the simulation thread is started, or on a headless game
+	ygl::Entity spawnGhost(glm::ivec2 position);
+	void		removeGhost(ygl::Entity ghost);
+	std::size_t getEntityCount() { return packedData.size(); }
+
+	// releases the ghosts, like the space key does. Call it on the simulation thread
+	void startGame();
+
+	// simulation state, for comparing games. Read it on the simulation thread
+	const int						 *getDistanceField() { return distanceMap[0]; }	    // width * height cells
+	const int						 *getNearestPlayerField() { return nearestPlayerMap[0]; }
+	std::span<const PacmanEntityData> getEntityData() { return packedData; }
+
+	// steers a pacman, like the arrow keys do for the first one. Call it on the simulation thread
+	void setPlayerInput(std::size_t player, Direction direction);
+	// queues a turn of the first pacman that was pressed at the given time, like the key callback does.
+	// can be called from any one thread. Returns false if the queue is full
+	bool queueTurn(Direction direction, std::chrono::steady_clock::time_point time);
+	// lets a pacman play by itself. Call it on the simulation thread
+	void setAutopilot(std::size_t player, bool enabled);
 
 	void drawGUI();
 
+	// draws the current simulation state on the CPU, with the fast or the reference path. Call it on the simulation thread
+	void rasterize(SoftwareRasterizer &rasterizer, uint8_t *pixels, bool reference = false);
+
 	void write(std::ostream &out) override;
 	void read(std::istream &in) override;
 };
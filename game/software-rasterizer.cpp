@@ -0,0 +1,253 @@
+#include "software-rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// rotates a vector by -angle. Quarter turns are done exactly, so that sampling
+// sprites at texel borders gives the same result in both render paths
+static glm::vec2 rotateBack(glm::vec2 v, float angle) {
+	float quarters = angle / (M_PI / 2);
+	if (std::abs(quarters - std::round(quarters)) < 1e-4) {
+		switch (((int)std::lround(quarters) % 4 + 4) % 4) {
+			case 0: return v;
+			case 1: return glm::vec2(v.y, -v.x);
+			case 2: return glm::vec2(-v.x, -v.y);
+			case 3: return glm::vec2(-v.y, v.x);
+		}
+	}
+	float c = std::cos(angle), s = std::sin(angle);
+	return glm::vec2(v.x * c + v.y * s, -v.x * s + v.y * c);
+}
+
+SoftwareRasterizer::SoftwareRasterizer(std::size_t mapWidth, std::size_t mapHeight, unsigned int pixelsPerTile,
+									   std::span<const glm::vec3> ghostColors)
+	: mapWidth(mapWidth),
+	  mapHeight(mapHeight),
+	  pixelsPerTile(pixelsPerTile),
+	  width(mapWidth * pixelsPerTile),
+	  height(mapHeight * pixelsPerTile),
+	  ghostColors(ghostColors.begin(), ghostColors.end()) {
+	if (pixelsPerTile == 0) THROW_RUNTIME_ERR("pixelsPerTile must be positive");
+
+	images[PACMAN_IMAGE] = loadImage("./resources/pacman.png");
+	images[MASK_IMAGE]	 = loadImage("./resources/ghost_mask.png");
+	images[EYES_IMAGE]	 = loadImage("./resources/ghost_eyes.png");
+
+	prerender();
+}
+
+SoftwareRasterizer::Image SoftwareRasterizer::loadImage(const std::string &file) {
+	Image	 image;
+	int		 channels;
+	stbi_uc *data = stbi_load(file.c_str(), &image.width, &image.height, &channels, 4);
+	if (data == nullptr) {
+		dbLog(ygl::LOG_ERROR, "Cannot load image: ", file, " : ", stbi_failure_reason());
+		THROW_RUNTIME_ERR("failed to load sprite for the software rasterizer");
+	}
+	image.texels.resize(image.width * image.height);
+	memcpy(image.texels.data(), data, image.texels.size() * sizeof(Texel));
+	stbi_image_free(data);
+	return image;
+}
+
+SoftwareRasterizer::TileType SoftwareRasterizer::tileType(char c) {
+	switch (c) {
+		case '.': return DOT;
+		case '@': return PILL;
+		case '#': return WALL;
+		default: return EMPTY;
+	}
+}
+
+// same as map.fs. The comparison is strict so that empty tiles do not get a dot in their exact center
+glm::vec3 SoftwareRasterizer::shadeTile(TileType type, glm::vec2 distanceFromCenter) {
+	float dotRadius = 0.03f * (type == DOT) + 0.1f * (type == PILL);
+	float dot		= glm::dot(distanceFromCenter, distanceFromCenter) < dotRadius;
+	return glm::vec3(dot, dot, glm::min(dot + (type == WALL), 1.f));
+}
+
+// nearest neighbour sampling, uv in [0, 1) with v pointing up
+SoftwareRasterizer::Texel SoftwareRasterizer::sampleImage(SpriteImage image, glm::vec2 uv) {
+	const Image &img = images[image];
+	int			 x	 = glm::clamp(int(std::floor(uv.x * img.width)), 0, img.width - 1);
+	int			 y	 = glm::clamp(int(std::floor((1.f - uv.y) * img.height)), 0, img.height - 1);
+	return img.texels[y * img.width + x];
+}
+
+// same as ghost.fs for ghosts, plain texture for pacman
+glm::vec4 SoftwareRasterizer::shadeSprite(const Sprite &sprite, Texel body, Texel eyes) {
+	glm::vec4 bodyColor = glm::vec4(glm::vec3(body.r, body.g, body.b) * (1.f / 255), body.a / 255.f);
+	if (sprite.type == PACMAN) return bodyColor;
+
+	glm::vec4 eyesColor = glm::vec4(glm::vec3(eyes.r, eyes.g, eyes.b) * (1.f / 255), eyes.a / 255.f);
+	if (sprite.type == GHOST && sprite.color >= ghostColors.size()) THROW_RUNTIME_ERR("unknown ghost color");
+	glm::vec3 albedo	= sprite.type == GHOST ? ghostColors[sprite.color] : glm::vec3(0);
+	if (sprite.type == DEAD_GHOST) bodyColor = glm::vec4(0, 0, 0, 0);
+	if (sprite.type == WEAK_GHOST) {
+		eyesColor = glm::vec4(glm::vec3(eyesColor.w), eyesColor.w);
+		albedo	  = glm::vec3(0.125, 0.125, 0.96);
+	}
+	glm::vec3 color = glm::vec3(bodyColor.x, bodyColor.y, bodyColor.z) * albedo +
+					  glm::vec3(eyesColor.x, eyesColor.y, eyesColor.z);
+	return glm::vec4(color, bodyColor.w + eyesColor.w);
+}
+
+void SoftwareRasterizer::blend(uint8_t *pixel, glm::vec4 color) {
+	float alpha = glm::clamp(color.w, 0.f, 1.f);
+	if (alpha == 0.f) return;
+	float src[channels] = {color.x, color.y, color.z};
+	for (std::size_t c = 0; c < channels; ++c) {
+		float value = glm::clamp(src[c], 0.f, 1.f) * 255.f * alpha + pixel[c] * (1.f - alpha);
+		pixel[c]	= uint8_t(value + 0.5f);
+	}
+}
+
+// prerendered look of a sprite: pacman, the weak and the dead ghost, then the ghost in each color
+std::size_t SoftwareRasterizer::spritePatchOffset(const Sprite &sprite, int rotation) {
+	std::size_t look = 0;
+	switch (sprite.type) {
+		case PACMAN: look = 0; break;
+		case WEAK_GHOST: look = 1; break;
+		case DEAD_GHOST: look = 2; break;
+		case GHOST:
+			if (sprite.color >= ghostColors.size()) THROW_RUNTIME_ERR("unknown ghost color");
+			look = 3 + sprite.color;
+			break;
+	}
+	return (look * 4 + rotation) * 2 * pixelsPerTile * pixelsPerTile * channels;
+}
+
+// shades the tiles and every look of the sprites at the output resolution once,
+// so that render() only has to copy and blend them
+void SoftwareRasterizer::prerender() {
+	const std::size_t ppt = pixelsPerTile;
+	for (int type = 0; type < TILE_TYPES_COUNT; ++type) {
+		std::vector<uint8_t> &pattern = tilePatterns[type];
+		pattern.resize(ppt * ppt * channels);
+		for (std::size_t j = 0; j < ppt; ++j) {
+			for (std::size_t i = 0; i < ppt; ++i) {
+				glm::vec2 distanceFromCenter((i + 0.5f) / ppt - 0.5f, (j + 0.5f) / ppt - 0.5f);
+				glm::vec3 color = shadeTile(TileType(type), distanceFromCenter);
+				uint8_t	 *pixel = &pattern[(j * ppt + i) * channels];
+				pixel[0]		= uint8_t(color.x * 255);
+				pixel[1]		= uint8_t(color.y * 255);
+				pixel[2]		= uint8_t(color.z * 255);
+			}
+		}
+	}
+
+	// in the order of spritePatchOffset()
+	std::vector<Sprite> looks = {{PACMAN, {}, 0, 0}, {WEAK_GHOST, {}, 0, 0}, {DEAD_GHOST, {}, 0, 0}};
+	for (unsigned int color = 0; color < ghostColors.size(); ++color) looks.push_back({GHOST, {}, 0, color});
+
+	const std::size_t patchSize = ppt * ppt * channels;
+	spritePatches.resize(looks.size() * 4 * 2 * patchSize);
+	for (const Sprite &look : looks) {
+		SpriteImage bodyImage = look.type == PACMAN ? PACMAN_IMAGE : MASK_IMAGE;
+		for (int rotation = 0; rotation < 4; ++rotation) {
+			uint8_t *colors		   = spritePatches.data() + spritePatchOffset(look, rotation);
+			uint8_t *inverseAlphas = colors + patchSize;
+			for (std::size_t j = 0; j < ppt; ++j) {
+				for (std::size_t i = 0; i < ppt; ++i) {
+					glm::vec2 local((i + 0.5f) / ppt - 0.5f, 0.5f - (j + 0.5f) / ppt);
+					glm::vec2 uv	= rotateBack(local, rotation * (M_PI / 2)) + glm::vec2(0.5f);
+					glm::vec4 color = shadeSprite(look, sampleImage(bodyImage, uv), sampleImage(EYES_IMAGE, uv));
+
+					// premultiplied, so that blending is one multiply per channel
+					float		alpha		  = glm::clamp(color.w, 0.f, 1.f);
+					float		src[channels] = {color.x, color.y, color.z};
+					std::size_t pixel		  = (j * ppt + i) * channels;
+					for (std::size_t c = 0; c < channels; ++c) {
+						colors[pixel + c]		 = uint8_t(glm::clamp(src[c], 0.f, 1.f) * 255.f * alpha + 0.5f);
+						inverseAlphas[pixel + c] = 255 - uint8_t(alpha * 255.f + 0.5f);
+					}
+				}
+			}
+		}
+	}
+}
+
+void SoftwareRasterizer::render(char **map, const std::vector<Sprite> &sprites, uint8_t *pixels) {
+	const std::size_t ppt	  = pixelsPerTile;
+	const std::size_t rowSize = ppt * channels;
+
+	// the map is a grid of copies of four tiles
+	for (std::size_t ty = 0; ty < mapHeight; ++ty) {
+		for (std::size_t tx = 0; tx < mapWidth; ++tx) {
+			const uint8_t *pattern = tilePatterns[tileType(map[ty][tx])].data();
+			uint8_t		  *dst	   = pixels + ((ty * ppt) * width + tx * ppt) * channels;
+			for (std::size_t j = 0; j < ppt; ++j) {
+				memcpy(dst + j * width * channels, pattern + j * rowSize, rowSize);
+			}
+		}
+	}
+
+	for (const Sprite &sprite : sprites) {
+		int rotation = ((int)std::lround(sprite.rotation / (M_PI / 2)) % 4 + 4) % 4;
+		int originX	 = std::lround((sprite.position.x + mapWidth / 2.f - 0.5f) * ppt);
+		int originY	 = std::lround((mapHeight / 2.f - sprite.position.y - 0.5f) * ppt);
+
+		const uint8_t *colors		 = spritePatches.data() + spritePatchOffset(sprite, rotation);
+		const uint8_t *inverseAlphas = colors + ppt * ppt * channels;
+
+		// the part of the sprite that is inside the output
+		int firstX = std::max(0, -originX), lastX = std::min(int(ppt), int(width) - originX);
+		int firstY = std::max(0, -originY), lastY = std::min(int(ppt), int(height) - originY);
+		int rowBytes = (lastX - firstX) * int(channels);
+		for (int j = firstY; j < lastY; ++j) {
+			std::size_t	   offset		= (j * ppt + firstX) * channels;
+			const uint8_t *src			= colors + offset;
+			const uint8_t *inverseAlpha = inverseAlphas + offset;
+			uint8_t		  *dst			= pixels + ((originY + j) * width + originX + firstX) * channels;
+			// dst = src + dst * (1 - alpha) on a whole row of bytes, a loop for the compiler to vectorize
+			for (int k = 0; k < rowBytes; ++k) {
+				dst[k] = uint8_t(src[k] + (dst[k] * inverseAlpha[k] + 127) / 255);
+			}
+		}
+	}
+}
+
+void SoftwareRasterizer::renderReference(char **map, const std::vector<Sprite> &sprites, uint8_t *pixels) {
+	const std::size_t ppt = pixelsPerTile;
+
+	for (std::size_t y = 0; y < height; ++y) {
+		for (std::size_t x = 0; x < width; ++x) {
+			glm::vec2 position((x + 0.5f) / ppt - 0.5f, (y + 0.5f) / ppt - 0.5f);
+			glm::vec2 center = glm::round(position);
+			glm::vec3 color	 = shadeTile(tileType(map[y / ppt][x / ppt]), position - center);
+			uint8_t	 *pixel	 = pixels + (y * width + x) * channels;
+			pixel[0]		 = uint8_t(color.x * 255);
+			pixel[1]		 = uint8_t(color.y * 255);
+			pixel[2]		 = uint8_t(color.z * 255);
+		}
+	}
+
+	for (const Sprite &sprite : sprites) {
+		SpriteImage bodyImage = sprite.type == PACMAN ? PACMAN_IMAGE : MASK_IMAGE;
+		for (std::size_t y = 0; y < height; ++y) {
+			for (std::size_t x = 0; x < width; ++x) {
+				glm::vec2 world((x + 0.5f) / ppt - mapWidth / 2.f, mapHeight / 2.f - (y + 0.5f) / ppt);
+				glm::vec2 local = rotateBack(world - sprite.position, sprite.rotation);
+				if (std::abs(local.x) >= 0.5f || std::abs(local.y) >= 0.5f) continue;
+
+				glm::vec2 uv = local + glm::vec2(0.5f);
+				blend(pixels + (y * width + x) * channels,
+					  shadeSprite(sprite, sampleImage(bodyImage, uv), sampleImage(EYES_IMAGE, uv)));
+			}
+		}
+	}
+}
+
+std::size_t SoftwareRasterizer::pixelDiff(const uint8_t *a, const uint8_t *b, std::size_t pixelCount,
+										  uint8_t tolerance) {
+	std::size_t count = 0;
+	for (std::size_t i = 0; i < pixelCount; ++i) {
+		bool differs = false;
+		for (std::size_t c = 0; c < channels; ++c) {
+			differs |= std::abs(int(a[i * channels + c]) - int(b[i * channels + c])) > tolerance;
+		}
+		count += differs;
+	}
+	return count;
+}
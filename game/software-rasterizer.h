@@ -0,0 +1,80 @@
+#pragma once
+#include <yoghurtgl.h>
+#include <texture.h>
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+// renders the game into a small RGB8 buffer on the CPU, without a GL context.
+// reproduces the look of map.fs, ghost.fs and the unlit pacman sprite.
+class SoftwareRasterizer {
+   public:
+	enum SpriteType { PACMAN, GHOST, WEAK_GHOST, DEAD_GHOST };
+
+	struct Sprite {
+		SpriteType	 type;
+		glm::vec2	 position;	   // world position, same as the sprite's transform
+		float		 rotation;
+		unsigned int color;		   // index of the ghost body color, ignored for the other types
+	};
+
+	static constexpr std::size_t channels = 3;
+
+   private:
+	struct Texel {
+		uint8_t r, g, b, a;
+	};
+
+	struct Image {
+		int				   width = 0, height = 0;
+		std::vector<Texel> texels;
+	};
+
+	enum TileType { EMPTY, DOT, PILL, WALL, TILE_TYPES_COUNT };
+	enum SpriteImage { PACMAN_IMAGE, MASK_IMAGE, EYES_IMAGE, SPRITE_IMAGES_COUNT };
+
+	std::size_t	 mapWidth, mapHeight;
+	unsigned int pixelsPerTile;
+	std::size_t	 width, height;	    // dimensions of the output in pixels
+
+	Image				   images[SPRITE_IMAGES_COUNT];
+	std::vector<glm::vec3> ghostColors;
+
+	// prerendered tiles and sprites, used by the fast path
+	std::vector<uint8_t> tilePatterns[TILE_TYPES_COUNT];	// pixelsPerTile^2 RGB pixels each
+	// every look of a sprite in each of the 4 rotations: pixelsPerTile^2 premultiplied RGB pixels, then as many
+	// with 1 - alpha in every channel, so that blending is the same byte operation for all channels.
+	// the looks are pacman, the weak and the dead ghost, then the ghost in each of the colors
+	std::vector<uint8_t> spritePatches;
+
+	static Image	loadImage(const std::string &file);
+	static TileType tileType(char c);
+
+	glm::vec3 shadeTile(TileType type, glm::vec2 distanceFromCenter);
+	Texel	  sampleImage(SpriteImage image, glm::vec2 uv);
+	glm::vec4 shadeSprite(const Sprite &sprite, Texel body, Texel eyes);
+	void	  blend(uint8_t *pixel, glm::vec4 color);
+	std::size_t spritePatchOffset(const Sprite &sprite, int rotation);
+
+	void prerender();
+
+   public:
+	SoftwareRasterizer(std::size_t mapWidth, std::size_t mapHeight, unsigned int pixelsPerTile,
+					   std::span<const glm::vec3> ghostColors);
+
+	std::size_t getWidth() { return width; }
+	std::size_t getHeight() { return height; }
+	std::size_t getBufferSize() { return width * height * channels; }
+
+	// fast path: copies prerendered tiles and blends prerendered sprites with integer math, row by row.
+	// sprites are snapped to the nearest pixel and rotation
+	void render(char **map, const std::vector<Sprite> &sprites, uint8_t *pixels);
+
+	// evaluates the shaders for every pixel. Slow, used as ground truth for render()
+	void renderReference(char **map, const std::vector<Sprite> &sprites, uint8_t *pixels);
+
+	// counts the pixels whose channels differ by more than tolerance
+	static std::size_t pixelDiff(const uint8_t *a, const uint8_t *b, std::size_t pixelCount, uint8_t tolerance);
+};
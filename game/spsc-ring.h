@@ -0,0 +1,35 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// lock-free ring buffer for one producer and one consumer thread.
+// unlike TripleBuffer it keeps every item, so nothing that the producer pushes is lost until the ring is full
+template <class T, std::size_t N>
+class SpscRing {
+	static_assert(N && (N & (N - 1)) == 0, "the capacity must be a power of two");
+
+	std::array<T, N> items;
+
+	std::atomic<std::size_t> head = 0;	   // next item to pop, written by the consumer
+	std::atomic<std::size_t> tail = 0;	   // next free slot, written by the producer
+
+   public:
+	// producer side. Returns false and drops the item if the ring is full
+	bool push(const T &item) {
+		std::size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == N) return false;
+		items[t % N] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side. Returns false if the ring is empty
+	bool pop(T &item) {
+		std::size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		item = items[h % N];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// hashed timer wheel. An event is put in the slot of its due time and the clock only visits
+// the slots it passes, so the cost of advancing does not depend on the number of pending events.
+// time is in arbitrary integer units (the game uses milliseconds of simulation time)
+template <class Event, std::size_t Slots = 256>
+class TimerWheel {
+	struct Entry {
+		uint64_t due;
+		Event	 event;
+	};
+
+	std::array<std::vector<Entry>, Slots> slots;
+	uint64_t							  now	  = 0;
+	std::size_t							  pending = 0;
+
+	// fires the due events of a slot. Events scheduled by fire() are safe, they are due later
+	template <class F>
+	void fireSlot(std::vector<Entry> &slot, uint64_t time, F &fire) {
+		for (std::size_t i = 0; i < slot.size();) {
+			if (slot[i].due > time) {	  // due in a later turn of the wheel
+				++i;
+				continue;
+			}
+			Event event = slot[i].event;
+			slot[i]		= slot.back();
+			slot.pop_back();
+			--pending;
+			fire(event);
+		}
+	}
+
+   public:
+	// a few entries per slot up front, so that scheduling in a running game does not allocate
+	TimerWheel() {
+		for (std::vector<Entry> &slot : slots) slot.reserve(4);
+	}
+
+	// the event fires when the clock passes now + delay. A zero delay fires on the next advance
+	void schedule(uint64_t delay, const Event &event) {
+		uint64_t due = now + (delay == 0 ? 1 : delay);
+		slots[due % Slots].push_back({due, event});
+		++pending;
+	}
+
+	// moves the clock to time and calls fire(event) for every event that is due
+	template <class F>
+	void advance(uint64_t time, F fire) {
+		if (time <= now) return;
+		// a whole turn of the wheel or more, every slot gets visited once
+		if (time - now >= Slots) {
+			now = time;
+			for (std::vector<Entry> &slot : slots) fireSlot(slot, time, fire);
+			return;
+		}
+		while (now < time) {
+			++now;
+			fireSlot(slots[now % Slots], now, fire);
+		}
+	}
+
+	uint64_t	getTime() const { return now; }
+	std::size_t size() const { return pending; }
+};
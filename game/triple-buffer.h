@@ -0,0 +1,39 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// lock-free triple buffer for one producer and one consumer thread.
+// the producer always has a private buffer to write in and the consumer always
+// has the latest complete buffer to read from, so neither side ever waits for the other.
+template <class T>
+class TripleBuffer {
+	static constexpr uint8_t indexMask = 3;
+	static constexpr uint8_t freshBit  = 4;	    // set when the shared buffer has not been read yet
+
+	T buffers[3];
+
+	std::atomic<uint8_t> shared		= 1;	 // index of the buffer that is currently being handed over
+	uint8_t				 writeIndex = 0;	 // owned by the producer
+	uint8_t				 readIndex	= 2;	 // owned by the consumer
+
+   public:
+	// buffer to fill in on the producer thread
+	T &writeBuffer() { return buffers[writeIndex]; }
+
+	// hands the write buffer over to the consumer and takes back the stale one
+	void publish() {
+		uint8_t previous = shared.exchange(writeIndex | freshBit, std::memory_order_acq_rel);
+		writeIndex		 = previous & indexMask;
+	}
+
+	// grabs the latest published buffer if there is one. Returns true if the read buffer changed
+	bool update() {
+		if (!(shared.load(std::memory_order_relaxed) & freshBit)) return false;
+		uint8_t previous = shared.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex		 = previous & indexMask;
+		return true;
+	}
+
+	// buffer to read from on the consumer thread. Valid until the next call to update()
+	const T &readBuffer() const { return buffers[readIndex]; }
+};
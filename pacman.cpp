@@ -9,12 +9,70 @@
 #include <shader.h>
 #include <asset_manager.h>
 #include "game/pacman-game.h"
+#include "game/differential-harness.h"
 
 #include <glm/gtx/string_cast.hpp>
 
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <vector>
+
 using namespace std;
 
-void run() {
+#ifdef PACMAN_ALLOCATION_CHECK
+// every heap allocation of the process is counted, for --allocation-check. This costs an atomic increment
+// per allocation, so it is only in builds with the PACMAN_ALLOCATION_CHECK option.
+// the array and nothrow forms call these ones
+static std::atomic<std::size_t> allocationCount = 0;
+
+void *operator new(std::size_t size) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void *memory = std::malloc(size ? size : 1)) return memory;
+	throw std::bad_alloc();
+}
+void operator delete(void *memory) noexcept { std::free(memory); }
+void operator delete(void *memory, std::size_t) noexcept { std::free(memory); }
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	std::size_t align = std::size_t(alignment);
+	size			  = (std::max<std::size_t>(size, 1) + align - 1) / align * align;	  // aligned_alloc wants a multiple
+#ifdef _WIN32
+	if (void *memory = _aligned_malloc(size, align)) return memory;
+#else
+	if (void *memory = std::aligned_alloc(align, size)) return memory;
+#endif
+	throw std::bad_alloc();
+}
+void operator delete(void *memory, std::align_val_t) noexcept {
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	std::free(memory);
+#endif
+}
+void operator delete(void *memory, std::size_t, std::align_val_t alignment) noexcept {
+	operator delete(memory, alignment);
+}
+#endif
+
+// options of the interactive game
+struct RunSettings {
+	bool autopilot			= false;
+	bool reportInputLatency = false;
+	bool lowLatency			= false;
+};
+
+void run(const RunSettings &runSettings, const std::optional<MetricsSink::Settings> &metricsSettings) {
+	auto startupBegin = std::chrono::steady_clock::now();
+
 	// create window
 	ygl::Window window = ygl::Window(600, 800, "Test Window", true, false);
 
@@ -23,6 +81,13 @@ void run() {
 	ygl::Renderer	  *renderer = scene.registerSystem<ygl::Renderer>(&window);
 	ygl::AssetManager *asman	= scene.getSystem<ygl::AssetManager>();
 	PacmanGame *game = scene.registerSystem<PacmanGame>(std::string("./resources/map.txt"), 21, 22);
+	game->gameSettings.autopilot		  = runSettings.autopilot;
+	game->gameSettings.reportInputLatency = runSettings.reportInputLatency;
+	game->gameSettings.lowLatency		  = runSettings.lowLatency;
+
+	// declared after the scene, so that it stops before the game is destroyed
+	std::unique_ptr<MetricsSink> metrics;
+	if (metricsSettings) metrics = std::make_unique<MetricsSink>(game->getMetrics(), *metricsSettings);
 
 	// default shader for the scene
 	ygl::VFShader *defaultShader = new ygl::VFShader("./shaders/unlit.vs", "./shaders/unlit.fs");
@@ -36,6 +101,13 @@ void run() {
 	// send material data to GPU
 	renderer->loadData();
 
+	dbLog(ygl::LOG_INFO, "time to first frame: ",
+		  std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startupBegin).count(),
+		  "ms, of which the game took ", game->getStartupTime(), "ms");
+
+	// the simulation runs on its own thread, the loop below only renders
+	game->startSimulation();
+
 	// main game loop
 	glClearColor(1.0f, 0.0f, 0.0f, 1.0);
 	while (!window.shouldClose()) {
@@ -47,10 +119,303 @@ void run() {
 		game->drawGUI();
 
 		window.swapBuffers();
+		// waiting for the GPU keeps the driver from queueing frames ahead, so the next one
+		// starts from fresh input. It costs some throughput
+		if (runSettings.lowLatency) glFinish();
+		game->framePresented();
+	}
+
+	game->stopSimulation();
+}
+
+struct MapFile {
+	std::string file   = "./resources/map.txt";
+	std::size_t width  = 21;
+	std::size_t height = 22;
+};
+
+// headless game in which the pacmen play by themselves and cannot die, so that a run ends only when it is won
+PacmanGame *createAutoplayGame(ygl::Scene &scene, std::istream &level, std::size_t width, std::size_t height) {
+	PacmanGame *game			 = scene.registerSystem<PacmanGame>(level, width, height, true);
+	game->gameSettings.autopilot = true;
+	game->gameSettings.godMode	 = true;
+	return game;
+}
+
+// headless stress test: fills a level with ghosts and measures the simulation alone
+void benchmarkGhosts(const MapFile &map, std::size_t ghostCount, std::size_t ticks, bool levelOfDetail) {
+	srand(0);
+	ygl::Scene	  scene;
+	std::ifstream level(map.file);
+	PacmanGame	 *game				   = createAutoplayGame(scene, level, map.width, map.height);
+	game->gameSettings.aiLevelOfDetail = levelOfDetail;
+
+	while (game->getEntityCount() < ghostCount + game->getPlayerCount()) {
+		glm::ivec2 cell(rand() % game->getWidth(), rand() % game->getHeight());
+		if (game->isFree(cell)) game->spawnGhost(cell);
+	}
+
+	auto		start = std::chrono::steady_clock::now();
+	std::size_t tick  = 0;
+	std::size_t levelCounts[PacmanGame::AI_LEVELS_COUNT]{};
+	for (; tick < ticks && !game->hasGameEnded(); ++tick) {
+		game->tick(1.f / game->gameSettings.tickRate);
+		for (std::size_t level = 0; level < PacmanGame::AI_LEVELS_COUNT; ++level) {
+			levelCounts[level] += game->getAILevelCounts()[level];
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << (levelOfDetail ? "level of detail AI: " : "full AI: ") << ghostCount << " ghosts, " << tick
+			  << " ticks in " << seconds * 1000 << " ms: " << tick / seconds << " ticks/s, "
+			  << seconds * 1e9 / (double(tick) * ghostCount) << " ns per ghost update" << std::endl;
+	std::cout << "\tghosts per tick:";
+	for (std::size_t level = 0; level < PacmanGame::AI_LEVELS_COUNT; ++level) {
+		std::cout << ' ' << GameMetrics::aiLevelNames[level] << ' ' << double(levelCounts[level]) / tick;
+	}
+	std::cout << std::endl;
+}
+
+// runs the differential harness on maps 0 to runs - 1. Returns false if any of them diverged
+bool runDifferential(std::size_t runs) {
+	DifferentialHarness harness;
+	std::size_t			diverged = 0, ticks = 0;
+	double				referenceSeconds = 0, candidateSeconds = 0;
+	for (std::size_t seed = 0; seed < runs; ++seed) {
+		DifferentialHarness::Result result = harness.run(seed);
+		if (result.diverged) {
+			std::cout << "DIVERGED " << result.divergence << std::endl;
+			++diverged;
+		}
+		ticks += result.ticks;
+		referenceSeconds += result.referenceSeconds;
+		candidateSeconds += result.candidateSeconds;
+	}
+
+	std::cout << runs - diverged << "/" << runs << " maps matched over " << ticks << " ticks" << std::endl;
+	std::cout << "reference: " << ticks / referenceSeconds << " ticks/s, candidate: " << ticks / candidateSeconds
+			  << " ticks/s, speedup " << referenceSeconds / candidateSeconds << "x" << std::endl;
+	return diverged == 0;
+}
+
+// renders game states from generated maps with the fast and the reference path of the software rasterizer,
+// then measures how many frames the fast path draws on one core. Returns false if any pair of frames differs.
+// the fast path snaps sprites to whole pixels, so every sprite may differ by a row and a column of pixels
+bool runRasterizerCheck(std::size_t states, unsigned int pixelsPerTile) {
+	const uint8_t tolerance = 2;	 // per channel, for rounding
+
+	std::size_t failed = 0, worst = 0;
+	for (std::size_t seed = 0; seed < states; ++seed) {
+		std::mt19937 rng(seed);
+		std::size_t	 width = 7 + rng() % 30, height = 7 + rng() % 30;
+		std::istringstream level(DifferentialHarness::generateMap(rng, width, height));
+
+		// the autopilot eats pills, so the frames also show weak and dead ghosts
+		srand(seed);
+		ygl::Scene	scene;
+		PacmanGame *game = createAutoplayGame(scene, level, width, height);
+		for (std::size_t tick = rng() % 1000; tick > 0 && !game->hasGameEnded(); --tick) {
+			game->tick(1.f / game->gameSettings.tickRate);
+		}
+
+		SoftwareRasterizer	 rasterizer(width, height, pixelsPerTile, PacmanGame::getGhostColors());
+		std::vector<uint8_t> fast(rasterizer.getBufferSize()), reference(rasterizer.getBufferSize());
+		game->rasterize(rasterizer, fast.data());
+		game->rasterize(rasterizer, reference.data(), true);
+
+		std::size_t pixelCount = rasterizer.getWidth() * rasterizer.getHeight();
+		std::size_t diff	   = SoftwareRasterizer::pixelDiff(fast.data(), reference.data(), pixelCount, tolerance);
+		std::size_t allowed	   = game->getEntityCount() * 2 * pixelsPerTile;
+		worst				   = std::max(worst, diff);
+		if (diff > allowed) {
+			std::cout << "DIFFERS map " << seed << " (" << width << "x" << height << "): " << diff << " pixels, at most "
+					  << allowed << " allowed" << std::endl;
+			++failed;
+		}
+	}
+	std::cout << states - failed << "/" << states << " frames matched the reference, at most " << worst
+			  << " differing pixels" << std::endl;
+
+	// throughput of the fast path, on the classic level
+	srand(0);
+	ygl::Scene	scene;
+	PacmanGame *game = scene.registerSystem<PacmanGame>(std::string("./resources/map.txt"), 21, 22, true);
+	SoftwareRasterizer	 rasterizer(21, 22, pixelsPerTile, PacmanGame::getGhostColors());
+	std::vector<uint8_t> pixels(rasterizer.getBufferSize());
+	std::size_t			 frames = 0;
+	auto				 start	= std::chrono::steady_clock::now();
+	auto				 end	= start + std::chrono::milliseconds(500);
+	for (; std::chrono::steady_clock::now() < end; ++frames) {
+		game->rasterize(rasterizer, pixels.data());
+	}
+	double milliseconds =
+		std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "fast path: " << frames / milliseconds << " frames/ms on one core at " << rasterizer.getWidth()
+			  << "x" << rasterizer.getHeight() << std::endl;
+	return failed == 0;
+}
+
+// plays the classic level headless after a warm-up, until it is won or ticks have passed.
+// returns false if any of these ticks allocated
+bool runAllocationCheck(std::size_t ticks) {
+#ifndef PACMAN_ALLOCATION_CHECK
+	std::cout << "allocations are not counted in this build, configure it with -DPACMAN_ALLOCATION_CHECK=ON"
+			  << std::endl;
+	return false;
+#else
+	const std::size_t warmUpTicks = 300;	 // the first ticks fill the buffers that are reused later
+
+	srand(0);
+	ygl::Scene	  scene;
+	std::ifstream level("./resources/map.txt");
+	PacmanGame	 *game = createAutoplayGame(scene, level, 21, 22);
+	SoftwareRasterizer	 rasterizer(game->getWidth(), game->getHeight(), 4, PacmanGame::getGhostColors());
+	std::vector<uint8_t> pixels(rasterizer.getBufferSize());
+
+	const float deltaTime = 1.f / game->gameSettings.tickRate;
+	for (std::size_t tick = 0; tick < warmUpTicks; ++tick) {
+		game->tick(deltaTime);
+		game->rasterize(rasterizer, pixels.data());
+	}
+
+	std::size_t allocatingTicks = 0, allocations = 0, tick = 0;
+	for (; tick < ticks && !game->hasGameEnded(); ++tick) {
+		std::size_t before = allocationCount.load(std::memory_order_relaxed);
+		game->tick(deltaTime);
+		game->rasterize(rasterizer, pixels.data());
+		std::size_t count = allocationCount.load(std::memory_order_relaxed) - before;
+		if (count == 0) continue;
+
+		if (allocatingTicks == 0) {
+			std::cout << "tick " << warmUpTicks + tick << " allocated " << count << " times" << std::endl;
+		}
+		++allocatingTicks;
+		allocations += count;
 	}
+	std::cout << allocations << " allocations in " << allocatingTicks << " of " << tick << " ticks after warm-up"
+			  << std::endl;
+	return allocatingTicks == 0;
+#endif
 }
 
-int main() {
+// plays late turns at a crossing with a pill right after it. A turn that arrives while pacman is entering the
+// pill's cell must take the crossing and leave the pill where it is, one that arrives after the pill was eaten
+// must be ignored. Returns false if either goes wrong
+bool runInputCheck() {
+	// pacman runs right along the corridor, the branch up is at x = 3 and the pill at x = 4
+	const std::size_t width = 9, height = 4;
+	const char		 *level = "#########\n"
+							  "#h#.#####\n"
+							  "#p..@...#\n"
+							  "#########";
+	const float		  pillX = -(width / 2.f) + 4.5f;	 // world x of the center of the pill's cell
+
+	// ticks until pacman is in the pill's cell, then as many more as given, then turns up
+	auto play = [&](std::size_t ticksInside, bool &turned, uint64_t &pillsEaten) {
+		std::istringstream levelText(level);
+		ygl::Scene		   scene;
+		PacmanGame		  *game = scene.registerSystem<PacmanGame>(levelText, width, height, true);
+		game->startGame();
+		game->setPlayerInput(0, PacmanGame::RIGHT);
+		// the pacmen are created first, so the keyboard one is the first entity
+		auto pacman = [&]() -> const PacmanGame::PacmanEntityData & { return game->getEntityData()[0]; };
+
+		const float deltaTime = 1.f / game->gameSettings.tickRate;
+		for (std::size_t tick = 0; tick < 1000 && pacman().position.x < pillX - 0.5f; ++tick) game->tick(deltaTime);
+		for (std::size_t tick = 0; tick < ticksInside; ++tick) game->tick(deltaTime);
+
+		game->queueTurn(PacmanGame::UP, std::chrono::steady_clock::now());
+		for (std::size_t tick = 0; tick < 60; ++tick) game->tick(deltaTime);
+		turned	   = pacman().position.y > 0;	  // the corridor is at y = -0.5, the branch up at y = 0.5
+		pillsEaten = game->getMetrics().pillsEaten;
+	};
+
+	bool	 ok = true, turned;
+	uint64_t pillsEaten;
+	play(0, turned, pillsEaten);
+	if (!turned || pillsEaten != 0) {
+		std::cout << "FAILED a turn arriving while entering the pill's cell: turned " << turned << ", pills eaten "
+				  << pillsEaten << std::endl;
+		ok = false;
+	}
+	play(2, turned, pillsEaten);
+	if (turned || pillsEaten != 1) {
+		std::cout << "FAILED a turn arriving after the pill was eaten: turned " << turned << ", pills eaten "
+				  << pillsEaten << std::endl;
+		ok = false;
+	}
+
+	if (ok) std::cout << "late turns are taken at the crossing without eating the next cell" << std::endl;
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	// --autopilot: pacman plays by itself, for smoke runs
+	// --benchmark-ghosts N: headless run with N ghosts, with and without AI level of detail, prints the throughput
+	// --benchmark-map FILE W H: level for the benchmark, the classic one by default
+	// --pack-assets: (re)builds the asset bundle that is read at startup and exits
+	// --metrics-jsonl FILE, --metrics-port PORT: writes game metrics to a file or serves them for Prometheus
+	// --metrics-interval MS: how often the JSONL metrics are written
+	// --differential N: compares the reference and the optimized simulation on N generated maps and exits
+	// --allocation-check N: plays N ticks after a warm-up, exits with an error if any of them allocated.
+	//   needs a build with the PACMAN_ALLOCATION_CHECK option
+	// --rasterizer-check N: compares the fast and the reference software render of N game states and exits
+	// --input-check: checks that late turns do not eat what is after the crossing, and exits
+	// --input-latency: logs the input-to-state and input-to-present latency of every frame that shows a new turn
+	// --low-latency: renders the latest tick without blending and waits for the GPU after every frame
+	RunSettings								runSettings;
+	std::size_t								benchmarkGhostCount = 0;
+	std::size_t								differentialRuns	= 0;
+	std::size_t								rasterizerStates	= 0;
+	std::size_t								allocationTicks		= 0;
+	MapFile									benchmarkMap;
+	std::optional<MetricsSink::Settings>	metricsSettings;
+	for (int i = 1; i < argc; ++i) {
+		if (std::string(argv[i]) == "--autopilot") runSettings.autopilot = true;
+		if (std::string(argv[i]) == "--input-latency") runSettings.reportInputLatency = true;
+		if (std::string(argv[i]) == "--input-check") return runInputCheck() ? 0 : 1;
+		if (std::string(argv[i]) == "--low-latency") runSettings.lowLatency = true;
+		if (std::string(argv[i]) == "--metrics-jsonl" && i + 1 < argc) {
+			if (!metricsSettings) metricsSettings.emplace();
+			metricsSettings->format = MetricsSink::JSONL;
+			metricsSettings->file	= argv[++i];
+		}
+		if (std::string(argv[i]) == "--metrics-port" && i + 1 < argc) {
+			if (!metricsSettings) metricsSettings.emplace();
+			metricsSettings->format = MetricsSink::PROMETHEUS;
+			metricsSettings->port	= std::stoul(argv[++i]);
+		}
+		if (std::string(argv[i]) == "--metrics-interval" && i + 1 < argc) {
+			if (!metricsSettings) metricsSettings.emplace();
+			metricsSettings->interval = std::chrono::milliseconds(std::stoul(argv[++i]));
+		}
+		if (std::string(argv[i]) == "--benchmark-ghosts" && i + 1 < argc) benchmarkGhostCount = std::stoul(argv[++i]);
+		if (std::string(argv[i]) == "--benchmark-map" && i + 3 < argc) {
+			benchmarkMap.file	= argv[++i];
+			benchmarkMap.width	= std::stoul(argv[++i]);
+			benchmarkMap.height = std::stoul(argv[++i]);
+		}
+		if (std::string(argv[i]) == "--differential" && i + 1 < argc) differentialRuns = std::stoul(argv[++i]);
+		if (std::string(argv[i]) == "--rasterizer-check" && i + 1 < argc) rasterizerStates = std::stoul(argv[++i]);
+		if (std::string(argv[i]) == "--allocation-check" && i + 1 < argc) allocationTicks = std::stoul(argv[++i]);
+		if (std::string(argv[i]) == "--pack-assets") {
+			AssetBundle bundle;
+			bundle.build();
+			bundle.save(AssetBundle::defaultFile);
+			return 0;
+		}
+	}
+
+	if (differentialRuns) return runDifferential(differentialRuns) ? 0 : 1;
+	if (rasterizerStates) return runRasterizerCheck(rasterizerStates, 8) ? 0 : 1;
+	if (allocationTicks) return runAllocationCheck(allocationTicks) ? 0 : 1;
+
+	if (benchmarkGhostCount) {
+		benchmarkGhosts(benchmarkMap, benchmarkGhostCount, 2000, false);
+		benchmarkGhosts(benchmarkMap, benchmarkGhostCount, 2000, true);
+		return 0;
+	}
+
 	if (ygl::init()) {
 		dbLog(ygl::LOG_ERROR, "ygl failed to init");
 		exit(1);
@@ -58,7 +423,7 @@ int main() {
 
 	srand(time(NULL));
 
-	run();
+	run(runSettings, metricsSettings);
 
 	ygl::terminate();
 	std::cerr << std::endl;